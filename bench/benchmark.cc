@@ -0,0 +1,63 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include <sched.h>
+
+#include "benchmark.hh"
+#include "runtime.hh"
+#include "util.hh"
+
+using namespace std;
+
+static atomic<uint64_t> allocations( 0 );
+
+/* count every allocation made through new (and so by the standard containers) */
+void * operator new( size_t size )
+{
+  allocations.fetch_add( 1, memory_order_relaxed );
+  if ( void * const ret = malloc( size ? size : 1 ) ) {
+    return ret;
+  }
+  throw bad_alloc();
+}
+
+void * operator new[]( size_t size )
+{
+  return operator new( size );
+}
+
+void operator delete( void * ptr ) noexcept
+{
+  free( ptr );
+}
+
+void operator delete[]( void * ptr ) noexcept
+{
+  free( ptr );
+}
+
+uint64_t allocation_count( void )
+{
+  return allocations.load( memory_order_relaxed );
+}
+
+void pin_to_current_cpu( void )
+{
+  pin_this_thread( SystemCall( "sched_getcpu", sched_getcpu() ) );
+}
+
+void print_benchmark_header( void )
+{
+  cout << left << setw( 44 ) << "benchmark" << right
+       << setw( 12 ) << "ns/op" << setw( 12 ) << "allocs/op" << setw( 14 ) << "ops/s" << endl;
+}
+
+void print_benchmark( const string & name, const double ns_per_op,
+		      const double allocations_per_op )
+{
+  cout << left << setw( 44 ) << name << right << fixed
+       << setw( 12 ) << setprecision( 1 ) << ns_per_op
+       << setw( 12 ) << setprecision( 2 ) << allocations_per_op
+       << setw( 14 ) << setprecision( 0 ) << 1.0e9 / ns_per_op << endl;
+}
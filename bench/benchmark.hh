@@ -0,0 +1,56 @@
+#ifndef BENCHMARK_HH
+#define BENCHMARK_HH
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <string>
+
+/* Heap allocations so far by this process (benchmark.cc replaces the
+   global operator new to count them). */
+uint64_t allocation_count( void );
+
+/* pin this thread to the CPU it is on, so runs don't migrate */
+void pin_to_current_cpu( void );
+
+void print_benchmark_header( void );
+void print_benchmark( const std::string & name, const double ns_per_op,
+		      const double allocations_per_op );
+
+/* Times `iterations` calls of op( i ): once to warm up, then REPEATS
+   times, reporting the fastest (the least disturbed) run. A benchmark
+   that does several "ops" per call (a batch of datagrams, say) passes
+   ops_per_call so that the figures are per op. */
+template <typename F>
+void benchmark( const std::string & name, const uint64_t iterations, F && op,
+		const uint64_t ops_per_call = 1 )
+{
+  static const unsigned int REPEATS = 5;
+
+  for ( uint64_t i = 0; i < iterations; i++ ) {
+    op( i );
+  }
+
+  double best_ns = std::numeric_limits<double>::max();
+  uint64_t allocations = 0;
+  for ( unsigned int repeat = 0; repeat < REPEATS; repeat++ ) {
+    const uint64_t allocations_before = allocation_count();
+    const auto start = std::chrono::steady_clock::now();
+    for ( uint64_t i = 0; i < iterations; i++ ) {
+      op( i );
+    }
+    const auto end = std::chrono::steady_clock::now();
+    allocations = allocation_count() - allocations_before;
+
+    const double ns = std::chrono::duration<double, std::nano>( end - start ).count();
+    best_ns = std::min( best_ns, ns );
+  }
+
+  const double ops = double( iterations ) * ops_per_call;
+  print_benchmark( name, best_ns / ops, allocations / ops );
+}
+
+#endif /* BENCHMARK_HH */
@@ -0,0 +1,396 @@
+/* the networking hot paths, one line each (run by "make bench"):
+   ns per op, heap allocations per op, and ops (or datagrams) per second */
+
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <endian.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "benchmark.hh"
+#include "address.hh"
+#include "bbr_controller.hh"
+#include "contest_message.hh"
+#include "controller.hh"
+#include "framing.hh"
+#include "output_queue.hh"
+#include "poller.hh"
+#include "ring_buffer.hh"
+#include "socket.hh"
+#include "timestamp.hh"
+#include "trace.hh"
+#include "util.hh"
+
+using namespace std;
+using namespace PollerShortNames;
+
+/* results go here, so the compiler can't skip the work */
+static volatile uint64_t sink;
+
+/* a datagram as the sender sends it (header, then dummy payload) */
+static const string DATAGRAM = ContestMessage( 42, string( 1424, 'x' ) ).to_string();
+
+/* how the header used to go on the wire: one string per field */
+static string put_header_field( const uint64_t n )
+{
+  const uint64_t network_order = htobe64( n );
+  return string( reinterpret_cast<const char *>( &network_order ),
+		 sizeof( network_order ) );
+}
+
+static string concatenated_to_string( const ContestMessage & message )
+{
+  const ContestMessage::Header & header = message.header;
+  return put_header_field( header.sequence_number )
+    + put_header_field( header.send_timestamp )
+    + put_header_field( header.ack_sequence_number )
+    + put_header_field( header.ack_send_timestamp )
+    + put_header_field( header.ack_recv_timestamp )
+    + put_header_field( header.ack_payload_length )
+    + message.payload;
+}
+
+static void bench_contest_message( const uint64_t iterations )
+{
+  benchmark( "ContestMessage::Header parse (in place)", iterations, [] ( uint64_t ) {
+      const ContestMessage::Header header( DATAGRAM.data(), DATAGRAM.size() );
+      sink = header.sequence_number;
+    } );
+
+  benchmark( "ContestMessage parse (string)", iterations, [] ( uint64_t ) {
+      const ContestMessage message( DATAGRAM );
+      sink = message.payload.size();
+    } );
+
+  string wire = DATAGRAM;
+  ContestMessage::Header header( 0 );
+  benchmark( "ContestMessage::Header serialize (in place)", iterations, [&] ( const uint64_t i ) {
+      header.sequence_number = i;
+      header.serialize( wire );
+    } );
+  sink = wire[ 0 ];
+
+  const ContestMessage message( 42, string( 1424, 'x' ) );
+  benchmark( "ContestMessage::to_string", iterations, [&] ( uint64_t ) {
+      sink = message.to_string().size();
+    } );
+
+  benchmark( "ContestMessage concatenated fields (old)", iterations, [&] ( uint64_t ) {
+      sink = concatenated_to_string( message ).size();
+    } );
+
+  /* turn a datagram into an ack, as the receiver does */
+  benchmark( "ContestMessage ack (transform + to_string)", iterations, [&] ( const uint64_t i ) {
+      ContestMessage ack( DATAGRAM );
+      ack.transform_into_ack( i, 1 );
+      sink = ack.to_string().size();
+    } );
+
+  string ack_wire( ContestMessage::Header::SIZE, 0 );
+  benchmark( "ContestMessage ack (in place)", iterations, [&] ( const uint64_t i ) {
+      const ContestMessage ack( DATAGRAM.data(), DATAGRAM.size(), i, 1 );
+      ack.header.serialize( ack_wire );
+    } );
+  sink = ack_wire[ 0 ];
+}
+
+/* steady state: each op sends one datagram, and acks the one sent WINDOW ago */
+template <class ControllerType>
+static void bench_controller( const string & name, const uint64_t iterations )
+{
+  static const uint64_t WINDOW = 64;
+  static const uint64_t GAP_NS = 100000; /* between sends */
+  static const uint64_t RTT_NS = 20000000;
+
+  ControllerType controller( false );
+  uint64_t seq = 0;
+  benchmark( name + " sent+ack_received", iterations, [&] ( uint64_t ) {
+      const uint64_t now = RTT_NS + seq * GAP_NS;
+      controller.datagram_was_sent( seq, now, DATAGRAM.size() );
+      if ( seq >= WINDOW ) {
+	const uint64_t acked = seq - WINDOW;
+	controller.ack_received( acked, RTT_NS + acked * GAP_NS, now - RTT_NS / 2, now );
+      }
+      seq++;
+    } );
+  sink = controller.window_size();
+}
+
+/* an ack with no delay (e.g. on loopback, within one clock tick) has no
+   rate to offer, so it must leave the window decisions that follow as
+   they would have been without it */
+static void check_controller_zero_delay( void )
+{
+  static const uint64_t RTT_NS = 10000000;
+
+  Controller with_ack( false ), without_ack( false );
+  for ( Controller * const controller : { &with_ack, &without_ack } ) {
+    controller->window_decrease(); /* (out of slow start, where the rate counts) */
+  }
+
+  with_ack.datagram_was_sent( 0, RTT_NS, DATAGRAM.size() );
+  with_ack.ack_received( 0, RTT_NS, RTT_NS, RTT_NS );
+
+  /* then ever bigger flights, each acked one RTT later */
+  uint64_t seq = 1, now = 2 * RTT_NS;
+  for ( uint64_t flight = 1; flight <= 50; flight++, now += RTT_NS ) {
+    for ( Controller * const controller : { &with_ack, &without_ack } ) {
+      for ( uint64_t i = 0; i < flight; i++ ) {
+	controller->datagram_was_sent( seq + i, now, DATAGRAM.size() );
+      }
+      for ( uint64_t i = 0; i < flight; i++ ) {
+	controller->ack_received( seq + i, now, now + RTT_NS / 2, now + RTT_NS );
+      }
+    }
+    seq += flight;
+  }
+
+  if ( with_ack.window_size() != without_ack.window_size() ) {
+    throw runtime_error( "Controller: an ack with no delay changed the window from "
+			 + to_string( without_ack.window_size() ) + " to "
+			 + to_string( with_ack.window_size() ) );
+  }
+}
+
+/* an eventfd that stays readable, so servicing it costs no syscall
+   and the Poller's own overhead is all that's measured */
+class AlwaysReady : public FileDescriptor
+{
+public:
+  AlwaysReady()
+    : FileDescriptor( SystemCall( "eventfd", eventfd( 1, EFD_CLOEXEC ) ) )
+  {}
+
+  void service( void ) { register_read(); }
+};
+
+static void bench_poll( const size_t count, const uint64_t events )
+{
+  vector<unique_ptr<AlwaysReady>> fds;
+  Poller poller;
+  uint64_t dispatched = 0;
+
+  for ( size_t i = 0; i < count; i++ ) {
+    fds.emplace_back( new AlwaysReady );
+    AlwaysReady & fd = *fds.back();
+    poller.add_action( Action( fd, Direction::In, [&fd, &dispatched] () {
+	  fd.service();
+	  dispatched++;
+	  return ResultType::Continue;
+	} ) );
+  }
+
+  benchmark( "Poller::poll, " + to_string( count ) + " ready fds (per event)",
+	     events / count, [&] ( uint64_t ) { poller.poll( -1 ); }, count );
+  sink = dispatched;
+}
+
+static void bench_address( const uint64_t iterations )
+{
+  const Address v4( "127.0.0.1", 9090 ), v6( "::1", 9090 );
+
+  benchmark( "Address::to_string (IPv4)", iterations, [&] ( uint64_t ) {
+      sink = v4.to_string().size();
+    } );
+  benchmark( "Address::to_string (IPv6)", iterations, [&] ( uint64_t ) {
+      sink = v6.to_string().size();
+    } );
+  benchmark( "Address::ip_port (IPv4)", iterations, [&] ( uint64_t ) {
+      sink = v4.ip_port().second;
+    } );
+}
+
+static void bench_timestamps( const uint64_t iterations )
+{
+  benchmark( "timestamp_ms", iterations, [] ( uint64_t ) { sink = timestamp_ms(); } );
+  benchmark( "timestamp_ns", iterations, [] ( uint64_t ) { sink = timestamp_ns(); } );
+}
+
+static const TraceEvent BENCH_EVENT( "bench", "i:u x:f" );
+
+/* what a trace() call costs the traced thread, with no log open and
+   with one draining to a file */
+static void bench_trace( const uint64_t iterations )
+{
+  benchmark( "trace (no log open)", iterations, [] ( const uint64_t i ) {
+      trace( BENCH_EVENT, i, i, 0.5 );
+    } );
+
+  const string filename = "/tmp/microbench." + to_string( getpid() ) + ".trace";
+  {
+    TraceLog log( filename );
+    benchmark( "trace (log open)", iterations, [] ( const uint64_t i ) {
+	trace( BENCH_EVENT, i, i, 0.5 );
+      } );
+    sink = log.dropped();
+  }
+  SystemCall( "unlink", unlink( filename.c_str() ) );
+}
+
+/* draining an empty nonblocking socket: the status API against
+   catching the exception that read() throws for EAGAIN */
+static void bench_would_block( const uint64_t iterations )
+{
+  UDPSocket socket;
+  socket.bind( Address( "::1", 0 ) );
+  socket.set_blocking( false );
+  char buffer[ 64 ];
+
+  benchmark( "FileDescriptor::read_some (would block)", iterations, [&] ( uint64_t ) {
+      sink = socket.read_some( buffer, sizeof( buffer ) ).would_block();
+    } );
+
+  benchmark( "FileDescriptor::read (throws EAGAIN)", iterations, [&] ( uint64_t ) {
+      try {
+	sink = socket.read( sizeof( buffer ) ).size();
+      } catch ( const unix_error & e ) {
+	sink = e.code().value();
+      }
+    } );
+}
+
+/* a stream of 64-byte lines through a socket pair, read and split two
+   ways (ops/s is lines/s) */
+static void bench_stream_read( const uint64_t lines )
+{
+  static const size_t LINES_PER_WRITE = 64;
+
+  int fds[ 2 ];
+  SystemCall( "socketpair", socketpair( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds ) );
+  FileDescriptor writer( fds[ 0 ] ), reader( fds[ 1 ] );
+
+  string block;
+  for ( size_t i = 0; i < LINES_PER_WRITE; i++ ) {
+    block += string( 63, 'a' + i % 26 ) + "\n";
+  }
+
+  RingBuffer input;
+  benchmark( "read_into+extract_lines (per line)", lines / LINES_PER_WRITE, [&] ( uint64_t ) {
+      writer.write( block );
+      size_t count = 0;
+      while ( count < LINES_PER_WRITE ) {
+	reader.read_into( input ).check( "read" );
+	count += extract_lines( input, [] ( const char * const line, const size_t length ) {
+	    sink = line[ length - 1 ];
+	  } );
+      }
+    }, LINES_PER_WRITE );
+
+  string pending;
+  benchmark( "read+string split (per line)", lines / LINES_PER_WRITE, [&] ( uint64_t ) {
+      writer.write( block );
+      size_t count = 0;
+      while ( count < LINES_PER_WRITE ) {
+	pending += reader.read();
+	for ( size_t newline; (newline = pending.find( '\n' )) != string::npos; count++ ) {
+	  const string line = pending.substr( 0, newline );
+	  sink = line.back();
+	  pending.erase( 0, newline + 1 );
+	}
+      }
+    }, LINES_PER_WRITE );
+}
+
+/* a chatty protocol's replies (32 bytes each, 64 per request) through
+   a socket pair: a write per reply, against queueing them and sending
+   them with one writev (ops/s is replies/s) */
+static void bench_stream_write( const uint64_t replies )
+{
+  static const size_t REPLIES_PER_REQUEST = 64;
+  static const string REPLY = string( 31, 'r' ) + "\n";
+
+  int fds[ 2 ];
+  SystemCall( "socketpair", socketpair( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds ) );
+  FileDescriptor writer( fds[ 0 ] ), reader( fds[ 1 ] );
+  RingBuffer input;
+
+  const auto drain = [&] () {
+    while ( input.size() < REPLIES_PER_REQUEST * REPLY.size() ) {
+      reader.read_into( input ).check( "read" );
+    }
+    input.consume( input.size() );
+  };
+
+  benchmark( "write_some per reply", replies / REPLIES_PER_REQUEST, [&] ( uint64_t ) {
+      for ( size_t i = 0; i < REPLIES_PER_REQUEST; i++ ) {
+	writer.write_some( REPLY ).check( "write" );
+      }
+      drain();
+    }, REPLIES_PER_REQUEST );
+
+  OutputQueue output;
+  benchmark( "OutputQueue push+flush (per reply)", replies / REPLIES_PER_REQUEST, [&] ( uint64_t ) {
+      for ( size_t i = 0; i < REPLIES_PER_REQUEST; i++ ) {
+	output.push( REPLY );
+      }
+      while ( not output.empty() ) {
+	output.flush( writer ).check( "writev" );
+      }
+      drain();
+    }, REPLIES_PER_REQUEST );
+}
+
+/* datagrams of the sender's size over loopback (ops/s is datagrams/s) */
+static void bench_udp( const uint64_t datagrams )
+{
+  static const size_t BATCH = 32;
+
+  UDPSocket receiver, sender;
+  receiver.set_timestamps();
+  receiver.bind( Address( "::1", 0 ) );
+  sender.connect( receiver.local_address() );
+
+  benchmark( "UDP send+recv (loopback, per datagram)", datagrams, [&] ( uint64_t ) {
+      sender.send( DATAGRAM );
+      sink = receiver.recv().payload.size();
+    } );
+
+  const vector<string> payloads( BATCH, DATAGRAM );
+  UDPSocket::ReceiveBuffers buffers( BATCH );
+  benchmark( "UDP send_batch+recv_into (batches of 32)", datagrams / BATCH, [&] ( uint64_t ) {
+      sender.send_batch( payloads );
+      for ( size_t received = 0; received < BATCH; ) {
+	received += receiver.recv_into( buffers );
+      }
+    }, BATCH );
+}
+
+int main( int argc, char *argv[] )
+{
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  if ( argc > 2 ) {
+    cerr << "Usage: " << argv[ 0 ] << " [SCALE]  (multiplies the iteration counts)" << endl;
+    return EXIT_FAILURE;
+  }
+
+  const double scale = argc > 1 ? stod( argv[ 1 ] ) : 1;
+  const auto count = [scale] ( const uint64_t n ) { return max( uint64_t( n * scale ), uint64_t( 1 ) ); };
+
+  pin_to_current_cpu();
+  print_benchmark_header();
+
+  bench_contest_message( count( 1000000 ) );
+  check_controller_zero_delay();
+  bench_controller<Controller>( "Controller", count( 1000000 ) );
+  bench_controller<BBRController>( "BBRController", count( 1000000 ) );
+  for ( const size_t fds : { 1, 64, 1024 } ) {
+    bench_poll( fds, count( 2000000 ) );
+  }
+  bench_address( count( 200000 ) );
+  bench_timestamps( count( 1000000 ) );
+  bench_trace( count( 1000000 ) );
+  bench_would_block( count( 200000 ) );
+  bench_stream_read( count( 1000000 ) );
+  bench_stream_write( count( 1000000 ) );
+  bench_udp( count( 100000 ) );
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,103 @@
+/* microbenchmark: Poller dispatch cost per ready event, and the cost of
+   building, copying and calling a callback as std::function vs. Delegate */
+
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <sys/eventfd.h>
+
+#include "poller.hh"
+#include "util.hh"
+
+using namespace std;
+using namespace PollerShortNames;
+
+/* an eventfd that stays readable; "servicing" it costs no syscall,
+   so the benchmark sees only the Poller's own overhead */
+class AlwaysReady : public FileDescriptor
+{
+public:
+  AlwaysReady()
+    : FileDescriptor( SystemCall( "eventfd", eventfd( 1, EFD_CLOEXEC ) ) )
+  {}
+
+  void service( void ) { register_read(); }
+};
+
+static double seconds_since( const chrono::steady_clock::time_point & start )
+{
+  return chrono::duration<double>( chrono::steady_clock::now() - start ).count();
+}
+
+/* ns per ready event dispatched by Poller::poll() with `count` ready fds */
+static void bench_poll( const size_t count, const size_t events )
+{
+  vector<unique_ptr<AlwaysReady>> fds;
+  Poller poller;
+  uint64_t sum = 0;
+
+  for ( size_t i = 0; i < count; i++ ) {
+    fds.emplace_back( new AlwaysReady );
+    AlwaysReady & fd = *fds.back();
+    poller.add_action( Action( fd, Direction::In, [&fd, &sum] () {
+	  fd.service();
+	  sum++;
+	  return ResultType::Continue;
+	} ) );
+  }
+
+  const size_t rounds = events / count;
+  const auto start = chrono::steady_clock::now();
+  for ( size_t i = 0; i < rounds; i++ ) {
+    poller.poll( -1 );
+  }
+  const double elapsed = seconds_since( start );
+
+  cout << "Poller::poll, " << count << " ready fds: "
+       << elapsed * 1e9 / (rounds * count) << " ns/event"
+       << " (" << sum << " events)" << endl;
+}
+
+/* ns to build, copy and call a callback with a few captured references */
+template <typename CallbackType>
+static void bench_callback( const string & name, const size_t iterations )
+{
+  uint64_t a = 0, b = 0, c = 0;
+  const auto start = chrono::steady_clock::now();
+  for ( size_t i = 0; i < iterations; i++ ) {
+    const CallbackType callback = [&a, &b, &c] () { a++; b += a; c ^= b; return true; };
+    const CallbackType copy = callback;
+    copy();
+  }
+  const double elapsed = seconds_since( start );
+
+  cout << name << ": " << elapsed * 1e9 / iterations << " ns per build+copy+call"
+       << " (" << c << ")" << endl;
+}
+
+int main( int argc, char *argv[] )
+{
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  if ( argc > 2 ) {
+    cerr << "Usage: " << argv[ 0 ] << " [EVENTS]" << endl;
+    return EXIT_FAILURE;
+  }
+
+  const size_t events = argc > 1 ? stoul( argv[ 1 ] ) : 10000000;
+
+  for ( const size_t count : { 1, 16, 256, 4096 } ) {
+    bench_poll( count, events );
+  }
+
+  bench_callback<function<bool(void)>>( "std::function", events );
+  bench_callback<Delegate<bool(void)>>( "Delegate     ", events );
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,265 @@
+/* loopback benchmark: streaming a file to a TCP socket, and relaying
+   one TCP connection to another, copying through user space (read and
+   write) versus inside the kernel (sendfile and splice) */
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "poller.hh"
+#include "socket.hh"
+#include "splice_pipe.hh"
+#include "util.hh"
+
+using namespace std;
+using namespace PollerShortNames;
+
+static const size_t BUFFER_SIZE = 65536;
+
+/* CPU time used by the calling thread, in seconds */
+static double thread_cpu_seconds( void )
+{
+  timespec ts;
+  SystemCall( "clock_gettime", clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts ) );
+  return ts.tv_sec + ts.tv_nsec / 1.0e9;
+}
+
+static double wall_seconds( void )
+{
+  timespec ts;
+  SystemCall( "clock_gettime", clock_gettime( CLOCK_MONOTONIC, &ts ) );
+  return ts.tv_sec + ts.tv_nsec / 1.0e9;
+}
+
+static void report( const string & name, const size_t bytes,
+		    const double wall, const double cpu )
+{
+  const double mib = bytes / 1048576.0;
+  cout << name << ": " << uint64_t( mib / wall ) << " MiB/s, "
+       << uint64_t( 1000 * cpu / ( mib / 1024 ) ) << " CPU ms/GiB in the sending thread" << endl;
+}
+
+/* a connected pair of loopback TCP sockets */
+static pair<TCPSocket, TCPSocket> connected_pair( void )
+{
+  TCPSocket listener;
+  listener.bind( Address( "::1", 0 ) );
+  listener.listen();
+
+  TCPSocket client;
+  client.connect( listener.local_address() );
+  return make_pair( move( client ), listener.accept() );
+}
+
+/* read and discard `total` bytes */
+static void drain( TCPSocket & socket, const size_t total )
+{
+  vector<char> buffer( 4 * BUFFER_SIZE );
+  for ( size_t received = 0; received < total; ) {
+    const IOResult result = socket.read_some( buffer.data(), buffer.size() ).check( "read" );
+    if ( result.eof() ) {
+      throw runtime_error( "connection closed early" );
+    }
+    received += result.count;
+  }
+}
+
+/* write `total` bytes (of a repeated pattern) */
+static void feed( TCPSocket & socket, const size_t total )
+{
+  const string pattern( 1048576, 'x' );
+  for ( size_t sent = 0; sent < total; ) {
+    const size_t length = min( pattern.size(), total - sent );
+    sent += socket.write_some( pattern.data(), length ).check( "write" ).count;
+  }
+}
+
+/* time one transfer of `total` bytes to `in`'s peer, drained by another thread */
+template <class Transfer>
+static void measure( const string & name, TCPSocket & in,
+		     const size_t total, Transfer && transfer )
+{
+  thread reader( [&in, total] () { drain( in, total ); } );
+
+  const double start_wall = wall_seconds(), start_cpu = thread_cpu_seconds();
+  transfer();
+  const double cpu = thread_cpu_seconds() - start_cpu;
+
+  reader.join();
+  report( name, total, wall_seconds() - start_wall, cpu );
+}
+
+/* relay `from` to `to` until `from` ends, through a user-space buffer */
+static void copy_relay( FileDescriptor & from, FileDescriptor & to )
+{
+  Poller poller;
+  vector<char> buffer( BUFFER_SIZE );
+  size_t start = 0, end = 0;
+
+  poller.add_action( Action( from, Direction::In,
+    [&] () {
+      const IOResult result = from.read_some( buffer.data(), buffer.size() ).check( "read" );
+      start = 0;
+      end = result.count;
+      return ResultType::Continue;
+    },
+    [&] () { return start == end; } ) );
+
+  poller.add_action( Action( to, Direction::Out,
+    [&] () {
+      start += to.write_some( buffer.data() + start, end - start ).check( "write" ).count;
+      return ResultType::Continue;
+    },
+    [&] () { return start < end; } ) );
+
+  while ( not ( from.eof() and start == end ) ) {
+    poller.poll( -1 );
+  }
+}
+
+/* relay `from` to `to` until `from` ends, through a SplicePipe */
+static void splice_relay( FileDescriptor & from, FileDescriptor & to )
+{
+  Poller poller;
+  SplicePipe pipe;
+  bool finished = false;
+
+  pipe.relay( poller, from, to,
+	      [&] ( const IOResult & result ) {
+		if ( result.failed() ) {
+		  throw unix_error( "splice", result.error );
+		}
+		finished = true;
+	      } );
+
+  while ( not finished ) {
+    poller.poll( -1 );
+  }
+}
+
+/* a relay must end (not stop its Poller) when a connection is reset
+   under it: here, with the pipe empty and the source idle, so that only
+   the reset can wake it */
+static void relay_reset_check( void )
+{
+  auto source = connected_pair(), destination = connected_pair();
+  source.second.set_blocking( false );
+  destination.first.set_blocking( false );
+
+  Poller poller;
+  SplicePipe pipe;
+  bool finished = false;
+  int error = 0;
+  pipe.relay( poller, source.second, destination.first,
+	      [&] ( const IOResult & result ) {
+		finished = true;
+		error = result.failed() ? result.error : 0;
+	      } );
+
+  /* relay some bytes, and leave them unread */
+  feed( source.first, BUFFER_SIZE );
+  Poller::Result::Type polled;
+  while ( ( polled = poller.poll( 100 ).result ) == PollResult::Success ) {}
+
+  /* closing a socket with unread data resets the connection */
+  { TCPSocket reader( move( destination.second ) ); }
+
+  while ( polled != PollResult::Exit and not finished ) {
+    polled = poller.poll( 1000 ).result;
+    if ( polled == PollResult::Timeout ) {
+      throw runtime_error( "relay: no end after a reset" );
+    }
+  }
+
+  if ( not finished or error == 0 ) {
+    throw runtime_error( "relay: a reset stopped the Poller instead of ending the relay" );
+  }
+  cout << "relay: reset     : ended with \"" << strerror( error ) << "\"" << endl;
+}
+
+int main( int argc, char *argv[] )
+{
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  if ( argc > 2 ) {
+    cerr << "Usage: " << argv[ 0 ] << " [MEBIBYTES]" << endl;
+    return EXIT_FAILURE;
+  }
+
+  const size_t total = ( argc > 1 ? stoul( argv[ 1 ] ) : 256 ) * 1048576;
+
+  /* a file of `total` bytes (in the page cache after it is written) */
+  char path[] = "/tmp/transfer_bench.XXXXXX";
+  FileDescriptor file( SystemCall( "mkstemp", mkstemp( path ) ) );
+  SystemCall( "unlink", unlink( path ) );
+  {
+    const string block( 1048576, 'x' );
+    for ( size_t written = 0; written < total; written += block.size() ) {
+      file.write( block );
+    }
+  }
+
+  auto stream = connected_pair();
+
+  /* read() the file into a buffer, write() the buffer to the socket */
+  measure( "file: read/write ", stream.second, total,
+	   [&] () {
+	     vector<char> buffer( BUFFER_SIZE );
+	     SystemCall( "lseek", lseek( file.fd_num(), 0, SEEK_SET ) );
+	     for ( size_t sent = 0; sent < total; ) {
+	       const IOResult result = file.read_some( buffer.data(), buffer.size() ).check( "read" );
+	       for ( size_t written = 0; written < result.count; ) {
+		 written += stream.first.write_some( buffer.data() + written,
+						     result.count - written ).check( "write" ).count;
+	       }
+	       sent += result.count;
+	     }
+	   } );
+
+  /* sendfile() straight from the page cache */
+  measure( "file: send_file  ", stream.second, total,
+	   [&] () {
+	     for ( size_t sent = 0; sent < total; ) {
+	       sent += stream.first.send_file( file, sent, total - sent ).check( "sendfile" ).count;
+	     }
+	   } );
+
+  /* relay: feeder -> [source] relay [destination] -> reader,
+     where the feeder closes its connection when it is done */
+  auto destination = connected_pair();
+  destination.first.set_blocking( false );
+
+  for ( const bool spliced : { false, true } ) {
+    auto source = connected_pair();
+    source.second.set_blocking( false );
+
+    thread feeder( [&source, total] () {
+	TCPSocket socket( move( source.first ) );
+	feed( socket, total );
+      } );
+
+    measure( spliced ? "relay: splice    " : "relay: read/write",
+	     destination.second, total,
+	     [&] () {
+	       if ( spliced ) {
+		 splice_relay( source.second, destination.first );
+	       } else {
+		 copy_relay( source.second, destination.first );
+	       }
+	     } );
+    feeder.join();
+  }
+
+  relay_reset_check();
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,118 @@
+/* loopback benchmark: datagrams per second per core, one syscall
+   per datagram versus recvmmsg/sendmmsg batches */
+
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <vector>
+
+#include "socket.hh"
+#include "util.hh"
+
+using namespace std;
+
+/* CPU time used by this process, in seconds */
+static double cpu_seconds( void )
+{
+  timespec ts;
+  SystemCall( "clock_gettime", clock_gettime( CLOCK_PROCESS_CPUTIME_ID, &ts ) );
+  return ts.tv_sec + ts.tv_nsec / 1.0e9;
+}
+
+static void report( const string & name, const size_t datagrams, const double seconds )
+{
+  cout << name << ": " << datagrams << " datagrams in " << seconds << " CPU s = "
+       << uint64_t( datagrams / seconds ) << " datagrams/s/core" << endl;
+}
+
+int main( int argc, char *argv[] )
+{
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  if ( argc > 3 ) {
+    cerr << "Usage: " << argv[ 0 ] << " [DATAGRAMS] [BATCH]" << endl;
+    return EXIT_FAILURE;
+  }
+
+  const size_t total = argc > 1 ? stoul( argv[ 1 ] ) : 1000000;
+  const size_t batch = argc > 2 ? stoul( argv[ 2 ] ) : 32;
+
+  UDPSocket receiver, sender;
+  receiver.set_timestamps();
+  receiver.bind( Address( "::1", 0 ) );
+  sender.connect( receiver.local_address() );
+
+  const vector<string> payloads( batch, string( 1472, 'x' ) );
+
+  /* one send() and one recv() per datagram */
+  {
+    const double start = cpu_seconds();
+    for ( size_t done = 0; done < total; done += batch ) {
+      for ( const auto & payload : payloads ) {
+	sender.send( payload );
+      }
+      for ( size_t i = 0; i < batch; i++ ) {
+	receiver.recv();
+      }
+    }
+    report( "send/recv            ", total, cpu_seconds() - start );
+  }
+
+  /* one sendmmsg() and (usually) one recvmmsg() per batch */
+  {
+    const double start = cpu_seconds();
+    for ( size_t done = 0; done < total; done += batch ) {
+      sender.send_batch( payloads );
+      for ( size_t received = 0; received < batch; ) {
+	received += receiver.recv_batch( batch - received ).size();
+      }
+    }
+    report( "send_batch/recv_batch", total, cpu_seconds() - start );
+  }
+
+  /* same, but received in place into reusable buffers */
+  {
+    UDPSocket::ReceiveBuffers buffers( batch );
+    const double start = cpu_seconds();
+    for ( size_t done = 0; done < total; done += batch ) {
+      sender.send_batch( payloads );
+      for ( size_t received = 0; received < batch; ) {
+	received += receiver.recv_into( buffers );
+      }
+    }
+    report( "send_batch/recv_into ", total, cpu_seconds() - start );
+  }
+
+  /* one GSO send per batch, received as coalesced GRO buffers */
+  if ( sender.gso_supported() ) {
+    UDPSocket gro_receiver;
+    gro_receiver.set_gro();
+    gro_receiver.bind( Address( "::1", 0 ) );
+
+    UDPSocket gso_sender;
+    gso_sender.connect( gro_receiver.local_address() );
+
+    const size_t segment_size = payloads.front().size();
+    const size_t per_send = min( batch, min( UDPSocket::MAX_GSO_SEGMENTS,
+					     UDPSocket::MAX_GSO_BYTES / segment_size ) );
+    const string super_buffer( per_send * segment_size, 'x' );
+
+    UDPSocket::ReceiveBuffers buffers( batch );
+    const double start = cpu_seconds();
+    for ( size_t done = 0; done < total; done += per_send ) {
+      gso_sender.send_segmented( super_buffer, segment_size );
+      for ( size_t received = 0; received < super_buffer.size(); ) {
+	const size_t count = gro_receiver.recv_into( buffers );
+	for ( size_t i = 0; i < count; i++ ) {
+	  received += buffers.payload_length( i );
+	}
+      }
+    }
+    report( "send_segmented/GRO   ", total, cpu_seconds() - start );
+  }
+
+  return EXIT_SUCCESS;
+}
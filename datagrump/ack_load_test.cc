@@ -0,0 +1,126 @@
+/* local load test: how many acks per second the receiver's shards
+   turn around, as the number of receiver threads grows */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+
+#include "socket.hh"
+#include "runtime.hh"
+#include "util.hh"
+#include "ack_shard.hh"
+#include "contest_message.hh"
+
+using namespace std;
+using namespace PollerShortNames;
+
+/* datagrams each client keeps in flight */
+static const size_t WINDOW = 32;
+
+/* one sending flow: keeps a window of datagrams outstanding, and
+   counts the acks that come back */
+static void run_client( const Address & server, const atomic<bool> & running, atomic<uint64_t> & acks )
+{
+  UDPSocket socket;
+  socket.connect( server );
+
+  const vector<string> window( WINDOW, ContestMessage( 0, string( 1400, 'x' ) ).to_string() );
+  UDPSocket::ReceiveBuffers replies( WINDOW );
+  uint64_t received = 0;
+
+  while ( running ) {
+    socket.send_batch( window );
+
+    /* collect the window's acks; give up on stragglers after a while */
+    for ( size_t outstanding = WINDOW; outstanding > 0 and running; ) {
+      pollfd pfd = { socket.fd_num(), POLLIN, 0 };
+      if ( SystemCall( "poll", poll( &pfd, 1, 20 ) ) == 0 ) {
+	break;
+      }
+      const size_t count = socket.recv_into( replies );
+      received += count;
+      outstanding -= min( count, outstanding );
+    }
+  }
+
+  acks += received;
+}
+
+/* acks per second with `threads` receiver shards and `clients` flows */
+static double measure( const size_t threads, const size_t clients, const double seconds )
+{
+  vector<unique_ptr<AckShard>> shards;
+  Runtime runtime( threads );
+
+  UDPSocket first = ack_socket( Address( "::1", 0 ), true );
+  const Address address = first.local_address();
+
+  for ( size_t i = 0; i < threads; i++ ) {
+    shards.emplace_back( new AckShard );
+    AckShard * const shard = shards.back().get();
+
+    runtime.worker( i ).hand_off( i == 0 ? move( first ) : ack_socket( address, true ),
+      [shard] ( Runtime::Worker & worker, UDPSocket & socket ) {
+	worker.poller().add_action( Action( socket, Direction::In,
+	  [shard, &socket] () {
+	    shard->ack_batch( socket );
+	    return ResultType::Continue;
+	  } ) );
+      } );
+  }
+
+  atomic<bool> running( true );
+  atomic<uint64_t> acks( 0 );
+  vector<thread> senders;
+  for ( size_t i = 0; i < clients; i++ ) {
+    senders.emplace_back( run_client, address, ref( running ), ref( acks ) );
+  }
+
+  this_thread::sleep_for( chrono::duration<double>( seconds ) );
+  running = false;
+  for ( auto & sender : senders ) {
+    sender.join();
+  }
+
+  runtime.stop();
+
+  return acks / seconds;
+}
+
+int main( int argc, char *argv[] )
+{
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  if ( argc > 4 ) {
+    cerr << "Usage: " << argv[ 0 ] << " [MAX_THREADS] [CLIENTS] [SECONDS]" << endl;
+    return EXIT_FAILURE;
+  }
+
+  const size_t cores = max( 1u, thread::hardware_concurrency() );
+  const size_t max_threads = argc > 1 ? stoul( argv[ 1 ] ) : max( size_t( 1 ), cores / 2 );
+  const size_t clients = argc > 2 ? stoul( argv[ 2 ] ) : 4 * max_threads;
+  const double seconds = argc > 3 ? stod( argv[ 3 ] ) : 2.0;
+
+  cout << clients << " client flows, " << cores << " cores" << endl;
+
+  double baseline = 0;
+  for ( size_t threads = 1; threads <= max_threads; threads *= 2 ) {
+    const double rate = measure( threads, clients, seconds );
+    if ( threads == 1 ) {
+      baseline = rate;
+    }
+    cout << threads << " receiver threads: " << uint64_t( rate ) << " acks/s"
+	 << " (" << rate / baseline << "x)" << endl;
+  }
+
+  return EXIT_SUCCESS;
+}
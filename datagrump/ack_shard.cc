@@ -0,0 +1,74 @@
+#include <algorithm>
+#include <iostream>
+
+#include "ack_shard.hh"
+#include "contest_message.hh"
+
+using namespace std;
+
+AckShard::AckShard( const size_t batch_size )
+  : batch_( batch_size ),
+    acks_(),
+    sequence_number_( 0 )
+{
+  acks_.reserve( batch_size );
+}
+
+size_t AckShard::ack_batch( UDPSocket & socket )
+{
+  const size_t count = socket.recv_into( batch_ );
+  size_t acks = 0;
+
+  for ( size_t i = 0; i < count; i++ ) {
+    const Address source = batch_.source_address( i );
+
+    /* split a coalesced buffer back into its datagrams */
+    for ( size_t offset = 0; offset < batch_.payload_length( i ); offset += batch_.segment_size( i ) ) {
+      const size_t length = min( batch_.segment_size( i ), batch_.payload_length( i ) - offset );
+
+      /* assemble the acknowledgment */
+      ContestMessage message( batch_.payload( i ) + offset, length,
+			      sequence_number_++, batch_.timestamp( i ) );
+
+      /* timestamp the ack just before sending */
+      message.set_send_timestamp();
+
+      /* write it into a reused string (acks are all header) */
+      if ( acks == acks_.size() ) {
+	acks_.emplace_back( source, string( ContestMessage::Header::SIZE, 0 ) );
+      } else {
+	acks_[ acks ].first = source;
+      }
+      message.header.serialize( acks_[ acks ].second );
+      acks++;
+    }
+  }
+
+  /* send the acks */
+  socket.sendto_batch( acks_, acks );
+
+  return acks;
+}
+
+UDPSocket ack_socket( const Address & address, const bool shared )
+{
+  UDPSocket socket;
+
+  /* turn on timestamps on receipt */
+  socket.set_timestamps();
+
+  /* let the kernel hand us bursts from a sender as one coalesced buffer */
+  try {
+    socket.set_gro();
+  } catch ( const exception & e ) {
+    cerr << "UDP GRO unavailable (" << e.what() << "), receiving datagrams one by one" << endl;
+  }
+
+  if ( shared ) {
+    socket.set_reuseport();
+  }
+
+  socket.bind( address );
+
+  return socket;
+}
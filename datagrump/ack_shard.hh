@@ -0,0 +1,36 @@
+#ifndef ACK_SHARD_HH
+#define ACK_SHARD_HH
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "socket.hh"
+
+/* One receiver shard: acknowledges the datagrams arriving on its own
+   socket, numbering its acks with its own sequence counter so that
+   shards on different threads share nothing. */
+class AckShard
+{
+private:
+  UDPSocket::ReceiveBuffers batch_;
+  std::vector<std::pair<Address, std::string>> acks_;
+  uint64_t sequence_number_;
+
+public:
+  /* pick up (and acknowledge) at most batch_size datagrams per syscall */
+  AckShard( const size_t batch_size = 64 );
+
+  /* receive one batch from `socket` and acknowledge every datagram
+     in it (blocks if nothing is waiting); returns how many */
+  size_t ack_batch( UDPSocket & socket );
+
+  /* acks sent so far */
+  uint64_t acked( void ) const { return sequence_number_; }
+};
+
+/* a receiver socket bound to `address`, ready to be one of several
+   shards on the same port if `shared` */
+UDPSocket ack_socket( const Address & address, const bool shared );
+
+#endif /* ACK_SHARD_HH */
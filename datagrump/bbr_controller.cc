@@ -0,0 +1,339 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "bbr_controller.hh"
+#include "timestamp.hh"
+#include "trace.hh"
+
+using namespace std;
+
+/* Per-packet events, for a TraceLog (see trace_decode) */
+static const TraceEvent SENT ("bbr_sent", "seq:u bytes:u");
+static const TraceEvent ACKED ("bbr_ack", "seq:u rtt_ns:u bandwidth:f window:f");
+static const TraceEvent LOST ("bbr_lost", "seq:u");
+
+/* 2/ln(2): enough to double the sending rate every round trip */
+static const double STARTUP_GAIN = 2.885;
+
+/* ProbeBW: probe for more bandwidth for one round trip, then drain
+   any queue that made, then cruise for six */
+static const double PACING_GAINS[] = { 1.25, 0.75, 1, 1, 1, 1, 1, 1 };
+static const unsigned int CYCLE_LENGTH = sizeof( PACING_GAINS ) / sizeof( PACING_GAINS[ 0 ] );
+
+/* in-flight allowance, in bandwidth-delay products (absorbs delayed and
+   aggregated acks, which cellular links are prone to) */
+static const double CWND_GAIN = 2.0;
+
+static const uint64_t BANDWIDTH_WINDOW_ROUNDS = 10;
+static const uint64_t MIN_RTT_WINDOW_NS = 10 * uint64_t( 1000000000 );
+static const uint64_t PROBE_RTT_DURATION_NS = 200 * uint64_t( 1000000 );
+
+static const double MIN_CWND = 4;      /* packets */
+static const double INITIAL_CWND = 10; /* packets */
+static const double SEND_QUANTUM = 3;  /* packets */
+
+static const double MIN_TIMEOUT_MS = 50;
+static const double MAX_TIMEOUT_MS = 1000;
+
+static const double MS = 1.0e6; /* nanoseconds per millisecond */
+
+BBRController::BBRController( const bool debug )
+  : debug_( debug ),
+    sent_packets_(),
+    mode_( Mode::Startup ),
+    max_bandwidth_( BANDWIDTH_WINDOW_ROUNDS, 0 ),
+    min_rtt_ns_( -1 ),
+    min_rtt_timestamp_( 0 ),
+    delivered_( 0 ),
+    delivered_timestamp_( 0 ),
+    first_sent_timestamp_( 0 ),
+    round_count_( 0 ),
+    next_round_delivered_( 0 ),
+    round_start_( false ),
+    full_bandwidth_( 0 ),
+    full_bandwidth_rounds_( 0 ),
+    filled_pipe_( false ),
+    cycle_index_( 0 ),
+    cycle_timestamp_( 0 ),
+    probe_rtt_done_timestamp_( 0 ),
+    probe_rtt_round_done_( false ),
+    prior_cwnd_( 0 ),
+    pacing_gain_( STARTUP_GAIN ),
+    cwnd_gain_( STARTUP_GAIN ),
+    cwnd_( INITIAL_CWND ),
+    srtt_ms_( 0 ),
+    rttvar_ms_( 0 )
+{
+  if ( debug_ ) {
+    cerr << "BBR: initial window is " << cwnd_ << endl;
+  }
+}
+
+/* the bandwidth-delay product, scaled by gain, in packets */
+double BBRController::bdp( const double gain ) const
+{
+  if ( bandwidth() <= 0 or min_rtt_ns_ == uint64_t( -1 ) ) {
+    return INITIAL_CWND;
+  }
+
+  return gain * bandwidth() * min_rtt_ns_ / 1.0e9;
+}
+
+unsigned int BBRController::window_size( void )
+{
+  return min( floor( cwnd_ ), double( sent_packets_.capacity() ) );
+}
+
+uint64_t BBRController::pacing_gap_ns( void ) const
+{
+  const double rate = pacing_gain_ * bandwidth(); /* packets/s */
+  return rate > 0 ? 1.0e9 / rate : 0;
+}
+
+void BBRController::datagram_was_sent( const uint64_t sequence_number,
+				       const uint64_t send_timestamp,
+				       const uint32_t bytes )
+{
+  /* a new flight starts the delivery-rate clock afresh */
+  if ( sent_packets_.outstanding() == 0 ) {
+    first_sent_timestamp_ = delivered_timestamp_ = send_timestamp;
+  }
+
+  SentPacketRing::Packet & packet = sent_packets_.sent( sequence_number, send_timestamp, bytes );
+  packet.delivered = delivered_;
+  packet.delivered_timestamp = delivered_timestamp_;
+  packet.first_sent_timestamp = first_sent_timestamp_;
+
+  trace( SENT, send_timestamp, sequence_number, bytes );
+}
+
+void BBRController::datagram_was_transmitted( const uint64_t sequence_number,
+					      const uint64_t tx_timestamp )
+{
+  SentPacketRing::Packet * const packet = sent_packets_.find( sequence_number );
+  if ( packet ) {
+    packet->tx_timestamp = tx_timestamp;
+    packet->has_tx_timestamp = true;
+  }
+}
+
+void BBRController::ack_received( const uint64_t sequence_number_acked,
+				  const uint64_t,
+				  const uint64_t,
+				  const uint64_t timestamp_ack_received )
+{
+  const uint64_t now = timestamp_ack_received;
+
+  SentPacketRing::Packet * const packet = sent_packets_.find( sequence_number_acked );
+  if ( not packet ) {
+    return; /* duplicate, or unknown */
+  }
+  sent_packets_.retire( *packet );
+
+  /* the path's RTT (from when the datagram left the host), and the
+     whole trip (for the timeout); on loopback the kernel can stamp the
+     ack's arrival before the datagram's departure, so fall back then */
+  const bool departed = packet->has_tx_timestamp and packet->tx_timestamp < now;
+  const uint64_t departure = departed ? packet->tx_timestamp : packet->send_timestamp;
+  const uint64_t rtt = now > departure ? now - departure : 0;
+  const double trip_ms = (now - packet->send_timestamp) / MS;
+  if ( srtt_ms_ == 0 ) {
+    srtt_ms_ = trip_ms;
+    rttvar_ms_ = trip_ms / 2;
+  } else {
+    rttvar_ms_ = 0.75 * rttvar_ms_ + 0.25 * fabs( srtt_ms_ - trip_ms );
+    srtt_ms_ = 0.875 * srtt_ms_ + 0.125 * trip_ms;
+  }
+
+  /* delivery rate over the longer of the send and ack intervals
+     (so that neither a burst of sends nor of acks inflates it) */
+  delivered_++;
+  delivered_timestamp_ = now;
+
+  const uint64_t send_elapsed = packet->send_timestamp - packet->first_sent_timestamp;
+  const uint64_t ack_elapsed = now - packet->delivered_timestamp;
+  const uint64_t interval = max( send_elapsed, ack_elapsed );
+  first_sent_timestamp_ = packet->send_timestamp;
+
+  update_round( *packet );
+
+  if ( interval > 0 and (min_rtt_ns_ == uint64_t( -1 ) or interval >= min_rtt_ns_) ) {
+    const double rate = (delivered_ - packet->delivered) * 1.0e9 / interval;
+    max_bandwidth_.update( round_count_, rate );
+  }
+
+  update_min_rtt( now, rtt );
+  check_full_pipe();
+  update_mode( now );
+  update_cwnd();
+
+  trace( ACKED, now, sequence_number_acked, rtt, bandwidth(), cwnd_ );
+}
+
+/* BBR steers by its model, not by loss: a lost datagram just stops
+   counting as in flight */
+void BBRController::datagram_was_lost( const uint64_t sequence_number,
+				       const uint64_t timestamp )
+{
+  SentPacketRing::Packet * const packet = sent_packets_.find( sequence_number );
+  if ( not packet ) {
+    return;
+  }
+  sent_packets_.retire( *packet );
+
+  trace( LOST, timestamp, sequence_number );
+}
+
+/* a round trip ends when a packet sent after the last one ended is acked */
+void BBRController::update_round( const SentPacketRing::Packet & packet )
+{
+  round_start_ = false;
+  if ( packet.delivered >= next_round_delivered_ ) {
+    next_round_delivered_ = delivered_;
+    round_count_++;
+    round_start_ = true;
+  }
+}
+
+void BBRController::update_min_rtt( const uint64_t now, const uint64_t rtt )
+{
+  const bool expired = now > min_rtt_timestamp_ + MIN_RTT_WINDOW_NS;
+
+  if ( rtt <= min_rtt_ns_ or expired ) {
+    min_rtt_ns_ = rtt;
+    min_rtt_timestamp_ = now;
+  }
+
+  /* the estimate is stale: drain the queue briefly to measure it afresh */
+  if ( expired and mode_ != Mode::ProbeRTT ) {
+    mode_ = Mode::ProbeRTT;
+    pacing_gain_ = 1;
+    cwnd_gain_ = 1;
+    prior_cwnd_ = cwnd_;
+    probe_rtt_done_timestamp_ = 0;
+  }
+}
+
+/* startup is over once three rounds in a row fail to grow the bandwidth by a quarter */
+void BBRController::check_full_pipe( void )
+{
+  if ( filled_pipe_ or not round_start_ ) {
+    return;
+  }
+
+  if ( bandwidth() >= full_bandwidth_ * 1.25 ) {
+    full_bandwidth_ = bandwidth();
+    full_bandwidth_rounds_ = 0;
+    return;
+  }
+
+  if ( ++full_bandwidth_rounds_ >= 3 ) {
+    filled_pipe_ = true;
+  }
+}
+
+void BBRController::enter_startup( void )
+{
+  mode_ = Mode::Startup;
+  pacing_gain_ = STARTUP_GAIN;
+  cwnd_gain_ = STARTUP_GAIN;
+}
+
+void BBRController::enter_probe_bw( const uint64_t now )
+{
+  mode_ = Mode::ProbeBW;
+  cycle_index_ = 2; /* start cruising (deterministic, so that runs repeat) */
+  cycle_timestamp_ = now;
+  pacing_gain_ = PACING_GAINS[ cycle_index_ ];
+  cwnd_gain_ = CWND_GAIN;
+}
+
+void BBRController::update_mode( const uint64_t now )
+{
+  const double in_flight = sent_packets_.outstanding();
+
+  switch ( mode_ ) {
+  case Mode::Startup:
+    if ( filled_pipe_ ) {
+      /* drain the queue that startup built */
+      mode_ = Mode::Drain;
+      pacing_gain_ = 1 / STARTUP_GAIN;
+      cwnd_gain_ = STARTUP_GAIN;
+    }
+    break;
+
+  case Mode::Drain:
+    if ( in_flight <= bdp( 1 ) ) {
+      enter_probe_bw( now );
+    }
+    break;
+
+  case Mode::ProbeBW:
+    {
+      const double gain = PACING_GAINS[ cycle_index_ ];
+      const bool elapsed = now - cycle_timestamp_ > min_rtt_ns_;
+      bool advance = elapsed;
+      if ( gain > 1 ) {
+	advance = elapsed and in_flight >= bdp( gain );
+      } else if ( gain < 1 ) {
+	advance = elapsed or in_flight <= bdp( 1 );
+      }
+
+      if ( advance ) {
+	cycle_index_ = (cycle_index_ + 1) % CYCLE_LENGTH;
+	cycle_timestamp_ = now;
+	pacing_gain_ = PACING_GAINS[ cycle_index_ ];
+      }
+    }
+    break;
+
+  case Mode::ProbeRTT:
+    if ( probe_rtt_done_timestamp_ == 0 and in_flight <= MIN_CWND ) {
+      probe_rtt_done_timestamp_ = now + PROBE_RTT_DURATION_NS;
+      probe_rtt_round_done_ = false;
+      next_round_delivered_ = delivered_;
+    } else if ( probe_rtt_done_timestamp_ ) {
+      if ( round_start_ ) {
+	probe_rtt_round_done_ = true;
+      }
+      if ( probe_rtt_round_done_ and now > probe_rtt_done_timestamp_ ) {
+	min_rtt_timestamp_ = now;
+	cwnd_ = max( cwnd_, prior_cwnd_ );
+	if ( filled_pipe_ ) {
+	  enter_probe_bw( now );
+	} else {
+	  enter_startup();
+	}
+      }
+    }
+    break;
+  }
+}
+
+void BBRController::update_cwnd( void )
+{
+  if ( mode_ == Mode::ProbeRTT ) {
+    cwnd_ = MIN_CWND;
+    return;
+  }
+
+  const double target = bdp( cwnd_gain_ ) + SEND_QUANTUM;
+
+  if ( filled_pipe_ ) {
+    cwnd_ = min( cwnd_ + 1, target );
+  } else if ( cwnd_ < target or delivered_ < INITIAL_CWND ) {
+    cwnd_ = cwnd_ + 1;
+  }
+
+  cwnd_ = max( cwnd_, MIN_CWND );
+}
+
+unsigned int BBRController::timeout_ms( void )
+{
+  if ( srtt_ms_ == 0 ) {
+    return MAX_TIMEOUT_MS;
+  }
+
+  return min( max( srtt_ms_ + 4 * rttvar_ms_, MIN_TIMEOUT_MS ), MAX_TIMEOUT_MS );
+}
@@ -0,0 +1,105 @@
+#ifndef BBR_CONTROLLER_HH
+#define BBR_CONTROLLER_HH
+
+#include <cstdint>
+#include <functional>
+
+#include "sent_packet_ring.hh"
+#include "windowed_filter.hh"
+
+/* Model-based congestion control in the style of BBR: estimate the
+   bottleneck bandwidth (windowed max of delivery-rate samples) and the
+   round-trip propagation delay (windowed min RTT), pace at about the
+   bandwidth, and keep about one bandwidth-delay product in flight, so
+   the bottleneck stays busy without a standing queue. */
+class BBRController
+{
+private:
+  enum class Mode { Startup, Drain, ProbeBW, ProbeRTT };
+
+  bool debug_;
+  SentPacketRing sent_packets_;
+  Mode mode_;
+
+  /* the model */
+  WindowedFilter<double, std::greater_equal<double>> max_bandwidth_; /* packets/s, over rounds */
+  uint64_t min_rtt_ns_;
+  uint64_t min_rtt_timestamp_;
+
+  /* delivery-rate sampling */
+  uint64_t delivered_;
+  uint64_t delivered_timestamp_;
+  uint64_t first_sent_timestamp_;
+
+  /* round trips, counted in deliveries */
+  uint64_t round_count_;
+  uint64_t next_round_delivered_;
+  bool round_start_;
+
+  /* has startup found the bandwidth? */
+  double full_bandwidth_;
+  unsigned int full_bandwidth_rounds_;
+  bool filled_pipe_;
+
+  /* gain cycling in ProbeBW */
+  unsigned int cycle_index_;
+  uint64_t cycle_timestamp_;
+
+  /* ProbeRTT */
+  uint64_t probe_rtt_done_timestamp_;
+  bool probe_rtt_round_done_;
+  double prior_cwnd_;
+
+  double pacing_gain_;
+  double cwnd_gain_;
+  double cwnd_; /* packets */
+
+  /* for the retransmission timeout */
+  double srtt_ms_;
+  double rttvar_ms_;
+
+  double bandwidth( void ) const { return max_bandwidth_.best(); }
+  double bdp( const double gain ) const; /* packets */
+
+  void enter_startup( void );
+  void enter_probe_bw( const uint64_t now );
+  void update_round( const SentPacketRing::Packet & packet );
+  void update_min_rtt( const uint64_t now, const uint64_t rtt );
+  void check_full_pipe( void );
+  void update_mode( const uint64_t now );
+  void update_cwnd( void );
+
+public:
+  BBRController( const bool debug );
+
+  /* window size, in datagrams */
+  unsigned int window_size( void );
+
+  /* spacing between datagrams, in nanoseconds (0: no pacing) */
+  uint64_t pacing_gap_ns( void ) const;
+
+  /* a datagram was sent (timestamps are in nanoseconds; see timestamp_ns()) */
+  void datagram_was_sent( const uint64_t sequence_number,
+			  const uint64_t send_timestamp,
+			  const uint32_t bytes );
+
+  /* a datagram left the host (kernel TX timestamp) */
+  void datagram_was_transmitted( const uint64_t sequence_number,
+				 const uint64_t tx_timestamp );
+
+  /* an ack was received */
+  void ack_received( const uint64_t sequence_number_acked,
+		     const uint64_t send_timestamp_acked,
+		     const uint64_t recv_timestamp_acked,
+		     const uint64_t timestamp_ack_received );
+
+  /* a datagram was declared lost (at `timestamp`) */
+  void datagram_was_lost( const uint64_t sequence_number,
+			  const uint64_t timestamp );
+
+  /* how long to wait (in milliseconds) if there are no acks
+     before sending one more datagram */
+  unsigned int timeout_ms( void );
+};
+
+#endif /* BBR_CONTROLLER_HH */
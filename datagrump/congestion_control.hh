@@ -0,0 +1,61 @@
+#ifndef CONGESTION_CONTROL_HH
+#define CONGESTION_CONTROL_HH
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "controller.hh"
+#include "bbr_controller.hh"
+
+/* Congestion-control algorithms, chosen by name at runtime.
+
+   A controller is any class with Controller's interface:
+     ControllerType( bool debug );
+     unsigned int window_size( void );
+     uint64_t pacing_gap_ns( void ) const;
+     void datagram_was_sent( sequence_number, send_timestamp, bytes );
+     void datagram_was_transmitted( sequence_number, tx_timestamp );
+     void datagram_was_lost( sequence_number, timestamp );
+     void ack_received( sequence_number_acked, send_timestamp_acked,
+                        recv_timestamp_acked, timestamp_ack_received );
+     unsigned int timeout_ms( void );
+
+   Code that drives one (the sender, say) is a template on the controller
+   type, instantiated once per algorithm, so the per-packet calls are
+   resolved at compile time rather than through virtual functions. */
+
+/* A pacing controller's datagrams go out in short bursts (about a
+   millisecond's worth, and at most as many as one GSO send carries),
+   each followed by a pause that pays for it at the controller's rate.
+   Of `allowed` datagrams the window has room for, send this many. */
+static const uint64_t PACING_QUANTUM_NS = 1000000;
+static const uint64_t MAX_PACED_BURST = 64;
+
+inline uint64_t paced_burst( const uint64_t allowed, const uint64_t pacing_gap_ns )
+{
+  const uint64_t burst = std::max( uint64_t( 2 ), std::min( MAX_PACED_BURST,
+							    PACING_QUANTUM_NS / pacing_gap_ns ) );
+  return std::min( allowed, burst );
+}
+
+/* the names, for usage messages (the first is the default) */
+static const char * const CONGESTION_CONTROL_NAMES = "delay|bbr";
+
+/* call Runner<ControllerType>::run( args... ) with the algorithm called `name` */
+template <template <typename> class Runner, typename... Args>
+int run_with_congestion_control( const std::string & name, Args &&... args )
+{
+  if ( name == "delay" ) {
+    return Runner<Controller>::run( std::forward<Args>( args )... );
+  } else if ( name == "bbr" ) {
+    return Runner<BBRController>::run( std::forward<Args>( args )... );
+  }
+
+  throw std::runtime_error( "unknown congestion control \"" + name + "\" (try "
+			    + CONGESTION_CONTROL_NAMES + ")" );
+}
+
+#endif /* CONGESTION_CONTROL_HH */
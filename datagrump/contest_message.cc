@@ -1,68 +1,117 @@
 #include <stdexcept>
+#include <cstring>
 
 #include "contest_message.hh"
 #include "timestamp.hh"
 
 using namespace std;
 
-/* helper to get the nth uint64_t field (in network byte order) */
-uint64_t get_header_field( const size_t n, const string & str )
+/* the whole header has to fit (checked once, before any field is read) */
+static const char * check_header_fits( const char * data, const size_t length )
 {
-  if ( str.size() < (n + 1) * sizeof( uint64_t ) ) {
+  if ( length < ContestMessage::Header::SIZE ) {
     throw runtime_error( "contest message too small to contain header" );
   }
 
-  const uint64_t * const data_ptr
-    = reinterpret_cast<const uint64_t *>( str.data() ) + n;
+  return data;
+}
+
+/* helper to get the nth uint64_t field (in network byte order) */
+static uint64_t get_header_field( const size_t n, const char * data )
+{
+  uint64_t network_order;
+  memcpy( &network_order, data + n * sizeof( uint64_t ), sizeof( network_order ) );
+
+  return be64toh( network_order );
+}
 
-  return be64toh( *data_ptr );
+/* helper to put the nth uint64_t field (in network byte order) */
+static void put_header_field( const size_t n, const uint64_t value, char * data )
+{
+  const uint64_t network_order = htobe64( value );
+  memcpy( data + n * sizeof( uint64_t ), &network_order, sizeof( network_order ) );
 }
 
 /* Parse header from wire */
 ContestMessage::Header::Header( const string & str )
-  : sequence_number( get_header_field( 0, str ) ),
-    send_timestamp( get_header_field( 1, str ) ),
-    ack_sequence_number( get_header_field( 2, str ) ),
-    ack_send_timestamp( get_header_field( 3, str ) ),
-    ack_recv_timestamp( get_header_field( 4, str ) ),
-    ack_payload_length( get_header_field( 5, str ) )
+  : Header( str.data(), str.size() )
+{}
+
+ContestMessage::Header::Header( const char * data, const size_t length )
+  : sequence_number( get_header_field( 0, check_header_fits( data, length ) ) ),
+    send_timestamp( get_header_field( 1, data ) ),
+    ack_sequence_number( get_header_field( 2, data ) ),
+    ack_send_timestamp( get_header_field( 3, data ) ),
+    ack_recv_timestamp( get_header_field( 4, data ) ),
+    ack_payload_length( get_header_field( 5, data ) )
 {}
 
 /* Parse incoming message from wire */
 ContestMessage::ContestMessage( const string & str )
-  : header( str ),
-    payload( str.begin() + sizeof( header ), str.end() )
+  : ContestMessage( str.data(), str.size() )
 {}
 
+ContestMessage::ContestMessage( const char * data, const size_t length )
+  : header( data, length ),
+    payload( data + Header::SIZE, length - Header::SIZE )
+{}
+
+/* Acknowledgment of an incoming message, parsed in place from the wire */
+ContestMessage::ContestMessage( const char * data, const size_t length,
+				const uint64_t sequence_number,
+				const uint64_t recv_timestamp )
+  : header( data, length ),
+    payload()
+{
+  header.ack_sequence_number = header.sequence_number;
+  header.sequence_number = sequence_number;
+  header.ack_send_timestamp = header.send_timestamp;
+  header.ack_recv_timestamp = recv_timestamp;
+  header.ack_payload_length = length - Header::SIZE;
+}
+
 /* Fill in the send_timestamp for an outgoing message */
 void ContestMessage::set_send_timestamp( void )
 {
-  header.send_timestamp = timestamp_ms();
+  header.send_timestamp = timestamp_ns();
 }
 
-/* helper to put a uint64_t field (in network byte order) */
-string put_header_field( const uint64_t n )
+/* Write wire representation into the front of a caller's buffer */
+void ContestMessage::Header::serialize( char * buffer, const size_t capacity ) const
 {
-  const uint64_t network_order = htobe64( n );
-  return string( reinterpret_cast<const char *>( &network_order ),
-		 sizeof( network_order ) );
+  if ( capacity < SIZE ) {
+    throw runtime_error( "buffer too small for contest message header" );
+  }
+
+  put_header_field( 0, sequence_number, buffer );
+  put_header_field( 1, send_timestamp, buffer );
+  put_header_field( 2, ack_sequence_number, buffer );
+  put_header_field( 3, ack_send_timestamp, buffer );
+  put_header_field( 4, ack_recv_timestamp, buffer );
+  put_header_field( 5, ack_payload_length, buffer );
+}
+
+void ContestMessage::Header::serialize( string & wire ) const
+{
+  /* (std::string storage is contiguous, and &wire[ 0 ] is writable) */
+  serialize( wire.empty() ? nullptr : &wire[ 0 ], wire.size() );
 }
 
 /* Make wire representation of header */
 string ContestMessage::Header::to_string( void ) const
 {
-  return put_header_field( sequence_number )
-    + put_header_field( send_timestamp )
-    + put_header_field( ack_sequence_number )
-    + put_header_field( ack_send_timestamp )
-    + put_header_field( ack_recv_timestamp )
-    + put_header_field( ack_payload_length );
+  string ret( SIZE, 0 );
+  serialize( ret );
+  return ret;
 }
 
 /* Make wire representation of message */
 string ContestMessage::to_string( void ) const
 {
-  return header.to_string() + payload;
+  string ret( Header::SIZE + payload.size(), 0 );
+  header.serialize( ret );
+  ret.replace( Header::SIZE, payload.size(), payload );
+  return ret;
 }
 
 /* Transform into an ack of the ContestMessage */
@@ -104,5 +153,10 @@ ContestMessage::Header::Header( const uint64_t s_sequence_number )
 /* Is this message an ack? */
 bool ContestMessage::is_ack( void ) const
 {
-  return header.ack_sequence_number != uint64_t( -1 );
+  return header.is_ack();
+}
+
+bool ContestMessage::Header::is_ack( void ) const
+{
+  return ack_sequence_number != uint64_t( -1 );
 }
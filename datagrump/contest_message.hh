@@ -6,6 +6,8 @@
 
 struct ContestMessage
 {
+  /* timestamps are in nanoseconds since the start of the sending
+     program (monotonic; see timestamp_ns()) */
   struct Header {
     uint64_t sequence_number;
     uint64_t send_timestamp;
@@ -15,14 +17,26 @@ struct ContestMessage
     uint64_t ack_recv_timestamp;
     uint64_t ack_payload_length;
 
+    /* bytes on the wire: six big-endian 64-bit fields */
+    static const size_t SIZE = 6 * sizeof( uint64_t );
+
     /* Header for new message */
     Header( const uint64_t s_sequence_number );
 
-    /* Parse header from wire */
+    /* Parse header from wire (in place; the payload isn't touched) */
     Header( const std::string & str );
+    Header( const char * data, const size_t length );
+
+    /* Write wire representation into the first SIZE bytes of a caller's
+       buffer (e.g. in front of a payload that is already there) */
+    void serialize( char * buffer, const size_t capacity ) const;
+    void serialize( std::string & wire ) const;
 
     /* Make wire representation of header */
     std::string to_string( void ) const;
+
+    /* Is this the header of an ack? */
+    bool is_ack( void ) const;
   } header;
 
   std::string payload;
@@ -33,6 +47,13 @@ struct ContestMessage
 
   /* Parse incoming datagram from wire */
   ContestMessage( const std::string & str );
+  ContestMessage( const char * data, const size_t length );
+
+  /* Acknowledgment of an incoming datagram, parsed in place from the wire
+     (without copying the datagram's payload) */
+  ContestMessage( const char * data, const size_t length,
+		  const uint64_t sequence_number,
+		  const uint64_t recv_timestamp );
 
   /* Fill in the send_timestamp for an outgoing datagram */
   void set_send_timestamp( void );
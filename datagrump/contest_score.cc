@@ -0,0 +1,54 @@
+/* score a mahimahi uplink log locally (what mm-throughput-graph and
+   the contest server report), as one line of JSON */
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "file_descriptor.hh"
+#include "link_log.hh"
+#include "util.hh"
+
+using namespace std;
+
+int main( int argc, char *argv[] )
+{
+   /* check the command-line arguments */
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  if ( argc > 2 ) {
+    cerr << "Usage: " << argv[ 0 ] << " [UPLINK_LOG]  (default: standard input)" << endl;
+    return EXIT_FAILURE;
+  }
+
+  const string filename = argc == 2 ? argv[ 1 ] : "-";
+  FileDescriptor log( filename == "-" ? STDIN_FILENO
+		      : SystemCall( "open " + filename, open( filename.c_str(), O_RDONLY | O_CLOEXEC ) ) );
+
+  /* read the log a buffer at a time */
+  LinkLogAnalyzer analyzer;
+  while ( not log.eof() ) {
+    analyzer.consume( log.read() );
+  }
+  analyzer.finish();
+
+  const LinkLogAnalyzer::Summary summary = analyzer.summary();
+  cout << fixed << setprecision( 4 )
+       << "{\"duration_ms\": " << summary.duration_ms
+       << ", \"capacity_mbps\": " << summary.capacity_mbps
+       << ", \"throughput_mbps\": " << summary.throughput_mbps
+       << ", \"utilization\": " << summary.utilization
+       << ", \"p95_queueing_delay_ms\": " << summary.p95_delay_ms
+       << ", \"power\": " << summary.power
+       << ", \"departures\": " << summary.departures
+       << ", \"drops\": " << summary.drops
+       << "}" << endl;
+
+  return EXIT_SUCCESS;
+}
@@ -1,19 +1,37 @@
+#include <algorithm>
 #include <iostream>
 #include <math.h>
 
 #include "controller.hh"
 #include "timestamp.hh"
+#include "trace.hh"
 
-#define MIN_RTT 50       /* Min RTT */
-#define MAX_RTT 5000     /* Max RTT */
-#define ALPHA   1.0/8.0  /* Alpha for RTT estimate */
-#define BETA    1.0/4.0  /* Beta for RTT variance weighting */ 
+#define MS      1.0e6    /* Nanoseconds per millisecond */
 
 using namespace std;
 
+/* Per-packet events, for a TraceLog (see trace_decode) */
+static const TraceEvent SENT ("delay_sent", "seq:u bytes:u");
+static const TraceEvent ACKED ("delay_ack", "seq:u delay_ms:f host_delay_ms:f window:f");
+static const TraceEvent IGNORED ("delay_ignored_ack", "seq:u");
+static const TraceEvent LOST ("delay_lost", "seq:u window:f");
+
+/* Hand-tuned defaults */
+Controller::Parameters::Parameters( void )
+  : alpha (1.0/8.0),
+    beta (1.0/4.0),
+    min_rto_ms (50),
+    max_rto_ms (5000),
+    delay_trigger_ms (120),
+    decrease_factor (0.85),
+    fast_threshold (0.6),
+    slow_threshold (0.3)
+{}
+
 /* Default constructor */
-Controller::Controller( const bool debug )
+Controller::Controller( const bool debug, const Parameters & s_params )
   : debug_( debug ), 
+    params (s_params),
     cwnd (2),
     link_rate_prev (0), 
     link_rate_ewma (10), 
@@ -21,9 +39,9 @@ Controller::Controller( const bool debug )
     SRTT (0),
     RTTVAR (0),
     RTO (1000),
-    q_occupancy (0),
-    q_occup_map (),
-    slow_start (true)
+    sent_packets (),
+    slow_start (true),
+    recovery_start (0)
 {
   if ( debug_ ) {
     cerr << "Initial window is " << cwnd << endl;
@@ -33,25 +51,30 @@ Controller::Controller( const bool debug )
 /* Get current window size, in datagrams */
 unsigned int Controller::window_size( void )
 {
-  if ( debug_ ) {
-    cout << "At time " << timestamp_ms()
-	 << " window size is " << cwnd << endl;
-  }
-  return floor (cwnd);
+  return min (floor (cwnd), double (sent_packets.capacity()));
 }
 
 /* A datagram was sent */
 void Controller::datagram_was_sent( const uint64_t sequence_number,
 				    /* of the sent datagram */
-				    const uint64_t send_timestamp )
-                                    /* in milliseconds */
+				    const uint64_t send_timestamp,
+                                    /* in nanoseconds */
+				    const uint32_t bytes )
 {
-  q_occupancy++;
-  q_occup_map [sequence_number] = q_occupancy;
+  sent_packets.sent (sequence_number, send_timestamp, bytes);
+  trace (SENT, send_timestamp, sequence_number, bytes);
+}
 
-  if ( debug_ ) {
-    cerr << "At time " << send_timestamp
-	 << " sent datagram " << sequence_number << endl;
+/* A datagram left the host */
+void Controller::datagram_was_transmitted( const uint64_t sequence_number,
+					   const uint64_t tx_timestamp )
+                                           /* in nanoseconds */
+{
+  /* ignore stragglers for datagrams already acked */
+  SentPacketRing::Packet * packet = sent_packets.find (sequence_number);
+  if (packet) {
+    packet->tx_timestamp = tx_timestamp;
+    packet->has_tx_timestamp = true;
   }
 }
 
@@ -60,49 +83,87 @@ void Controller::ack_received( const uint64_t sequence_number_acked,
 			       /* what sequence number was acknowledged */
 			       const uint64_t send_timestamp_acked,
 			       /* when the acknowledged datagram was sent (sender's clock) */
-			       const uint64_t recv_timestamp_acked,
+			       const uint64_t,
 			       /* when the acknowledged datagram was received (receiver's clock)*/
 			       const uint64_t timestamp_ack_received )
                                /* when the ack was received (by sender) */
+                               /* (all in nanoseconds) */
 {
-  q_occupancy--;
-  double delay = timestamp_ack_received - send_timestamp_acked;
-  double link_rate_cur = q_occup_map [sequence_number_acked] / delay;
-  /* Remove packet */
-  q_occup_map.erase(sequence_number_acked);
-
-  double dtr = 1000 * (link_rate_cur - link_rate_prev);
-  link_rate_ewma = ALPHA * dtr + (1-ALPHA) * link_rate_ewma;
+  /* Only the first ack of a packet we know about counts */
+  SentPacketRing::Packet * packet = sent_packets.find (sequence_number_acked);
+  if (not packet) {
+    trace (IGNORED, timestamp_ack_received, sequence_number_acked);
+    return;
+  }
+  sent_packets.retire (*packet);
+
+  /* Measure from when the datagram left our host, if the kernel said;
+     time spent queued before that is ours, not the network's. (The
+     kernel's stamp is converted from another clock, so it can land
+     outside the send and the ack; then use the send time instead.) */
+  bool departed = packet->has_tx_timestamp
+    and packet->tx_timestamp >= send_timestamp_acked
+    and packet->tx_timestamp <= timestamp_ack_received;
+  uint64_t departure = departed ? packet->tx_timestamp : send_timestamp_acked;
+  double host_delay = (departure - send_timestamp_acked) / MS;
+
+  /* in milliseconds, but no longer rounded to them */
+  double delay = (timestamp_ack_received - departure) / MS;
+
+  /* An ack in the same tick as its departure gives no rate (dividing
+     by its delay would make the trend inf or NaN for good) */
+  bool have_rate = delay > 0;
+  double dtr = 0;
+  if (have_rate)
+    {
+      double link_rate_cur = packet->in_flight / delay;
+      dtr = 1000 * (link_rate_cur - link_rate_prev);
+      link_rate_ewma = params.alpha * dtr + (1-params.alpha) * link_rate_ewma;
+      link_rate_prev = link_rate_cur;
+    }
   double incr = 0;
 
   /* Update window */
   if (slow_start)
     incr = 1;
-  else if (dtr > link_rate_ewma*0.6) 
+  else if (not have_rate)
+    incr = 0;
+  else if (dtr > link_rate_ewma*params.fast_threshold) 
     incr = 3/cwnd;
-  else if (dtr > link_rate_ewma*0.3)
+  else if (dtr > link_rate_ewma*params.slow_threshold)
     incr = 2/cwnd;
   else if (dtr > 0)
     incr = 1/cwnd;
   
   cwnd = cwnd + incr;
-  
-  link_rate_prev = link_rate_cur;
 
-  rtt_estimate (delay);
+  /* the timeout has to cover the whole trip, our own queueing included */
+  rtt_estimate (host_delay + delay);
   
   /* Adjust window */
-  if (delay > 120)
+  if (delay > params.delay_trigger_ms)
     window_decrease ();
   
-  if ( debug_ ) {
-    cerr << "At time " << timestamp_ack_received
-	 << " received ack for datagram " << sequence_number_acked
-	 << " (send @ time " << send_timestamp_acked
-	 << ", received @ time " << recv_timestamp_acked << " by receiver's clock)"
-	 << ", window is " << cwnd 
-         << endl;
+  trace (ACKED, timestamp_ack_received, sequence_number_acked, delay, host_delay, cwnd);
+}
+
+/* A datagram was lost */
+void Controller::datagram_was_lost( const uint64_t sequence_number,
+				    const uint64_t timestamp )
+{
+  SentPacketRing::Packet * packet = sent_packets.find (sequence_number);
+  if (not packet)
+    return;
+  sent_packets.retire (*packet);
+
+  /* Back off once per flight: the rest of the datagrams sent
+     before the last decrease were sent at the old window */
+  if (packet->send_timestamp >= recovery_start) {
+    window_decrease ();
+    recovery_start = timestamp;
   }
+
+  trace (LOST, timestamp, sequence_number, cwnd);
 }
 
 /* How long to wait (in milliseconds) if there are no acks
@@ -117,7 +178,7 @@ void Controller::window_decrease(void)
 {
   if (slow_start)
     slow_start = false;
-  cwnd *= 0.85;
+  cwnd *= params.decrease_factor;
 }
 
 /* Estimate RTT */
@@ -131,13 +192,13 @@ void Controller::rtt_estimate (double rtt_cur)
     }
   else 
     {
-      RTTVAR = (1 - BETA) * RTTVAR + (BETA * fabs(SRTT - rtt_cur));
-      SRTT = (1 - ALPHA)*SRTT + (ALPHA * rtt_cur);
+      RTTVAR = (1 - params.beta) * RTTVAR + (params.beta * fabs(SRTT - rtt_cur));
+      SRTT = (1 - params.alpha)*SRTT + (params.alpha * rtt_cur);
     }
     RTO = SRTT + 4* RTTVAR; 
-    if (RTO < MIN_RTT)
-      RTO = MIN_RTT;
-    else if (RTO > MAX_RTT)
-      RTO = MAX_RTT; 
+    if (RTO < params.min_rto_ms)
+      RTO = params.min_rto_ms;
+    else if (RTO > params.max_rto_ms)
+      RTO = params.max_rto_ms; 
 }
 
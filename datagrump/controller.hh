@@ -2,13 +2,33 @@
 #define CONTROLLER_HH
 
 #include <cstdint>
-#include <map>
 
-/* Congestion controller interface */
+#include "sent_packet_ring.hh"
+
+/* Delay-triggered congestion controller: grows the window with the
+   trend in delivery rate and backs off when delay passes 120 ms */
 class Controller
 {
+public:
+  /* The constants the algorithm depends on (the defaults are the
+     hand-tuned ones; tune finds others) */
+  struct Parameters
+  {
+    double alpha;            /* Gain for RTT and rate-trend averages */
+    double beta;             /* Gain for RTT variance */
+    double min_rto_ms;       /* Timeout bounds */
+    double max_rto_ms;
+    double delay_trigger_ms; /* Back off when delay passes this */
+    double decrease_factor;  /* ... by multiplying the window by this */
+    double fast_threshold;   /* Grow fastest when the rate trend passes this share of its average */
+    double slow_threshold;   /* ... and faster than slowest past this one */
+
+    Parameters( void );
+  };
+
 private:
   bool debug_; /* Enables debugging output */
+  Parameters params;
   double cwnd;    /* Variable window size */
   double link_rate_prev; /* Previous link rate */
   double link_rate_ewma;          /* Threshold for additive increase */
@@ -16,9 +36,9 @@ private:
   double SRTT;	         /* Estimated RTT */
   double RTTVAR;         /* RTT variance */
   double RTO;            /* Timeout */
-  int q_occupancy;       /* Queue occupancy */
-  std::map <uint64_t, int> q_occup_map; /* Tracking queue occupancy per packet*/
+  SentPacketRing sent_packets; /* Per packet: send time, size, queue occupancy */
   bool slow_start;      /* Are we in slow start */
+  uint64_t recovery_start; /* Losses sent before this were already answered */
 
 public:
   /* Public interface for the congestion controller */
@@ -26,14 +46,21 @@ public:
      the call site as well (in sender.cc) */
 
   /* Default constructor */
-  Controller( const bool debug );
+  Controller( const bool debug, const Parameters & s_params = Parameters() );
 
-  /* Get current window size, in datagrams */
+  /* Get current window size, in datagrams (never more than
+     the sent-packet ring can track) */
   unsigned int window_size( void );
 
-  /* A datagram was sent */
+  /* A datagram was sent (timestamps are in nanoseconds; see timestamp_ns()) */
   void datagram_was_sent( const uint64_t sequence_number,
-			  const uint64_t send_timestamp );
+			  const uint64_t send_timestamp,
+			  const uint32_t bytes );
+
+  /* A datagram left the host (kernel TX timestamp), so anything
+     before this was queueing in our own process and kernel */
+  void datagram_was_transmitted( const uint64_t sequence_number,
+				 const uint64_t tx_timestamp );
 
   /* An ack was received */
   void ack_received( const uint64_t sequence_number_acked,
@@ -41,6 +68,14 @@ public:
 		     const uint64_t recv_timestamp_acked,
 		     const uint64_t timestamp_ack_received );
 
+  /* The sender gave up on a datagram (declared lost at `timestamp`) */
+  void datagram_was_lost( const uint64_t sequence_number,
+			  const uint64_t timestamp );
+
+  /* Spacing between datagrams, in nanoseconds (0: send whenever
+     the window allows, which is what this controller does) */
+  uint64_t pacing_gap_ns( void ) const { return 0; }
+
   /* How long to wait (in milliseconds) if there are no acks
      before sending one more datagram */
   unsigned int timeout_ms( void );
@@ -0,0 +1,175 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "link_log.hh"
+
+using namespace std;
+
+static const char BASE_TIMESTAMP[] = "# base timestamp:";
+
+LinkLogAnalyzer::LinkLogAnalyzer( void )
+  : base_timestamp_( 0 ),
+    have_base_timestamp_( false ),
+    last_timestamp_( 0 ),
+    capacity_bytes_( 0 ),
+    departed_bytes_( 0 ),
+    departures_( 0 ),
+    drops_( 0 ),
+    delay_counts_(),
+    partial_line_(),
+    line_number_( 0 )
+{}
+
+/* helpers to read a field of a line (no allocation, no NUL needed) */
+static void skip_spaces( const char * & p, const char * const end )
+{
+  while ( p < end and (*p == ' ' or *p == '\t' or *p == '\r') ) {
+    p++;
+  }
+}
+
+static bool read_number( const char * & p, const char * const end, uint64_t & value )
+{
+  skip_spaces( p, end );
+  if ( p == end or *p < '0' or *p > '9' ) {
+    return false;
+  }
+
+  value = 0;
+  while ( p < end and *p >= '0' and *p <= '9' ) {
+    value = value * 10 + (*p - '0');
+    p++;
+  }
+  return true;
+}
+
+void LinkLogAnalyzer::parse_line( const char * begin, const char * const end )
+{
+  line_number_++;
+
+  const char * p = begin;
+  skip_spaces( p, end );
+  if ( p == end ) {
+    return;
+  }
+
+  if ( *p == '#' ) {
+    const size_t length = sizeof( BASE_TIMESTAMP ) - 1;
+    if ( size_t( end - p ) > length and memcmp( p, BASE_TIMESTAMP, length ) == 0 ) {
+      p += length;
+      if ( not read_number( p, end, base_timestamp_ ) ) {
+	throw runtime_error( "link log line " + to_string( line_number_ ) + ": bad base timestamp" );
+      }
+      have_base_timestamp_ = true;
+    }
+    return;
+  }
+
+  uint64_t timestamp, bytes;
+  if ( not read_number( p, end, timestamp ) ) {
+    throw runtime_error( "link log line " + to_string( line_number_ ) + ": no timestamp" );
+  }
+
+  skip_spaces( p, end );
+  const char event = p < end ? *p++ : 0;
+  if ( not read_number( p, end, bytes ) ) {
+    throw runtime_error( "link log line " + to_string( line_number_ ) + ": no byte count" );
+  }
+
+  if ( not have_base_timestamp_ ) {
+    base_timestamp_ = timestamp;
+    have_base_timestamp_ = true;
+  }
+  last_timestamp_ = max( last_timestamp_, timestamp );
+
+  switch ( event ) {
+  case '#':
+    capacity_bytes_ += bytes;
+    break;
+
+  case '-':
+    {
+      uint64_t delay;
+      if ( not read_number( p, end, delay ) ) {
+	throw runtime_error( "link log line " + to_string( line_number_ ) + ": no delay" );
+      }
+
+      departed_bytes_ += bytes;
+      departures_++;
+      if ( delay >= delay_counts_.size() ) {
+	delay_counts_.resize( delay + 1 );
+      }
+      delay_counts_[ delay ]++;
+    }
+    break;
+
+  case 'd':
+    drops_++;
+    break;
+
+  case '+':
+    break;
+
+  default:
+    throw runtime_error( "link log line " + to_string( line_number_ ) + ": unknown event" );
+  }
+}
+
+void LinkLogAnalyzer::consume( const string & chunk )
+{
+  const char * begin = chunk.data();
+  const char * const end = begin + chunk.size();
+
+  while ( const char * const newline = static_cast<const char *>( memchr( begin, '\n', end - begin ) ) ) {
+    if ( partial_line_.empty() ) {
+      parse_line( begin, newline );
+    } else {
+      partial_line_.append( begin, newline );
+      parse_line( partial_line_.data(), partial_line_.data() + partial_line_.size() );
+      partial_line_.clear();
+    }
+    begin = newline + 1;
+  }
+
+  partial_line_.append( begin, end );
+}
+
+void LinkLogAnalyzer::finish( void )
+{
+  if ( not partial_line_.empty() ) {
+    parse_line( partial_line_.data(), partial_line_.data() + partial_line_.size() );
+    partial_line_.clear();
+  }
+}
+
+LinkLogAnalyzer::Summary LinkLogAnalyzer::summary( void ) const
+{
+  Summary ret { 0, 0, 0, 0, 0, 0, departures_, drops_ };
+
+  ret.duration_ms = last_timestamp_ > base_timestamp_ ? last_timestamp_ - base_timestamp_ : 0;
+  if ( ret.duration_ms ) {
+    ret.capacity_mbps = capacity_bytes_ * 8.0 / ret.duration_ms / 1000;
+    ret.throughput_mbps = departed_bytes_ * 8.0 / ret.duration_ms / 1000;
+  }
+  if ( capacity_bytes_ ) {
+    ret.utilization = double( departed_bytes_ ) / capacity_bytes_;
+  }
+
+  /* the delay of the departure at the 95th percentile, in sorted order */
+  const uint64_t rank = departures_ * 95 / 100;
+  uint64_t seen = 0;
+  for ( size_t delay = 0; delay < delay_counts_.size(); delay++ ) {
+    seen += delay_counts_[ delay ];
+    if ( seen > rank ) {
+      ret.p95_delay_ms = delay;
+      break;
+    }
+  }
+
+  if ( ret.p95_delay_ms ) {
+    ret.power = ret.throughput_mbps / (ret.p95_delay_ms / 1000.0);
+  }
+
+  return ret;
+}
@@ -0,0 +1,62 @@
+#ifndef LINK_LOG_HH
+#define LINK_LOG_HH
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* Scores a mahimahi link log (mm-link --uplink-log) the way
+   mm-throughput-graph does, in one streaming pass: the log goes in in
+   chunks of any size, and memory is bounded by the largest queueing
+   delay (delays are kept as a histogram of milliseconds), not by the
+   length of the log. The log's lines are
+     # comment (including "# base timestamp: T")
+     T # BYTES          a delivery opportunity
+     T + BYTES          a packet arrived at the queue
+     T - BYTES DELAY    a packet left, after DELAY ms in the queue
+     T d BYTES          a packet was dropped
+   with times in milliseconds. */
+class LinkLogAnalyzer
+{
+public:
+  struct Summary
+  {
+    uint64_t duration_ms;
+    double capacity_mbps;
+    double throughput_mbps;
+    double utilization;
+    uint64_t p95_delay_ms; /* per-packet queueing delay */
+    double power;          /* throughput over that delay, in Mbit/s per second */
+    uint64_t departures;
+    uint64_t drops;
+  };
+
+private:
+  uint64_t base_timestamp_;
+  bool have_base_timestamp_;
+  uint64_t last_timestamp_;
+
+  uint64_t capacity_bytes_;
+  uint64_t departed_bytes_;
+  uint64_t departures_;
+  uint64_t drops_;
+  std::vector<uint64_t> delay_counts_; /* departures, by delay in ms */
+
+  std::string partial_line_; /* the end of a chunk that didn't end a line */
+  uint64_t line_number_;
+
+  void parse_line( const char * begin, const char * const end );
+
+public:
+  LinkLogAnalyzer( void );
+
+  /* the next part of the log */
+  void consume( const std::string & chunk );
+
+  /* at the end of the log (a last line may lack its newline) */
+  void finish( void );
+
+  Summary summary( void ) const;
+};
+
+#endif /* LINK_LOG_HH */
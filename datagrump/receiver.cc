@@ -2,11 +2,15 @@
 
 #include <cstdlib>
 #include <iostream>
+#include <memory>
+#include <vector>
 
 #include "socket.hh"
-#include "contest_message.hh"
+#include "runtime.hh"
+#include "ack_shard.hh"
 
 using namespace std;
+using namespace PollerShortNames;
 
 int main( int argc, char *argv[] )
 {
@@ -15,38 +19,61 @@ int main( int argc, char *argv[] )
     abort();
   }
 
-  if ( argc != 2 ) {
-    cerr << "Usage: " << argv[ 0 ] << " PORT" << endl;
+  if ( argc != 2 and argc != 3 ) {
+    cerr << "Usage: " << argv[ 0 ] << " PORT [THREADS]" << endl;
     return EXIT_FAILURE;
   }
 
-  /* create UDP socket for incoming datagrams */
-  UDPSocket socket;
-
-  /* turn on timestamps on receipt */
-  socket.set_timestamps();
+  const size_t threads = argc == 3 ? stoul( argv[ 2 ] ) : 1;
+  if ( threads == 0 ) {
+    cerr << "THREADS must be at least 1" << endl;
+    return EXIT_FAILURE;
+  }
 
-  /* "bind" the socket to the user-specified local port number */
-  socket.bind( Address( "::0", argv[ 1 ] ) );
+  /* create UDP socket for incoming datagrams, and "bind" it to the
+     user-specified local port number */
+  UDPSocket socket = ack_socket( Address( "::0", argv[ 1 ] ), threads > 1 );
 
   cerr << "Listening on " << socket.local_address().to_string() << endl;
 
-  uint64_t sequence_number = 0;
+  if ( threads == 1 ) {
+    /* Loop and acknowledge every incoming datagram back to its source */
+    AckShard shard;
+    while ( true ) {
+      shard.ack_batch( socket );
+    }
+  }
 
-  /* Loop and acknowledge every incoming datagram back to its source */
-  while ( true ) {
-    const UDPSocket::received_datagram recd = socket.recv();
-    ContestMessage message = recd.payload;
+  /* Sharded: one socket per pinned worker thread, all on the same port.
+     The kernel hashes each flow to one socket, so every shard acks its
+     own share of the senders, with its own sequence numbers. */
+  vector<unique_ptr<AckShard>> shards;
+  Runtime runtime( threads );
+  const Address address = socket.local_address();
 
-    /* assemble the acknowledgment */
-    message.transform_into_ack( sequence_number++, recd.timestamp );
+  for ( size_t i = 0; i < threads; i++ ) {
+    shards.emplace_back( new AckShard );
+    AckShard * const shard = shards.back().get();
 
-    /* timestamp the ack just before sending */
-    message.set_send_timestamp();
+    UDPSocket shard_socket = i == 0 ? move( socket ) : ack_socket( address, true );
 
-    /* send the ack */
-    socket.sendto( recd.source_address, message.to_string() );
+    runtime.worker( i ).hand_off( move( shard_socket ),
+      [shard] ( Runtime::Worker & worker, UDPSocket & shard_socket ) {
+	if ( worker.cpu() >= 0 ) {
+	  shard_socket.set_incoming_cpu( worker.cpu() );
+	}
+
+	worker.poller().add_action( Action( shard_socket, Direction::In,
+	  [shard, &shard_socket] () {
+	    shard->ack_batch( shard_socket );
+	    return ResultType::Continue;
+	  } ) );
+      } );
   }
 
-  return EXIT_SUCCESS;
+  cerr << "Acking with " << threads << " threads" << endl;
+
+  runtime.wait();
+
+  return EXIT_FAILURE;
 }
@@ -0,0 +1,144 @@
+#include <algorithm>
+
+#include "scoreboard.hh"
+
+using namespace std;
+
+Scoreboard::Scoreboard( const unsigned int capacity_log2 )
+  : packets_( capacity_log2 ),
+    next_sequence_number_( 0 ),
+    lowest_outstanding_( 0 ),
+    rack_sequence_number_( 0 ),
+    rack_send_timestamp_( 0 ),
+    rack_rtt_( 0 ),
+    rack_valid_( false ),
+    min_rtt_( -1 ),
+    acked_( 0 ),
+    lost_( 0 ),
+    spurious_( 0 ),
+    newly_lost_()
+{}
+
+void Scoreboard::sent( const uint64_t sequence_number, const uint64_t send_timestamp,
+		       const uint32_t bytes )
+{
+  packets_.sent( sequence_number, send_timestamp, bytes );
+  next_sequence_number_ = max( next_sequence_number_, sequence_number + 1 );
+
+  /* (anything the ring evicted has lapped it, so is no longer in flight) */
+  if ( next_sequence_number_ - lowest_outstanding_ > packets_.capacity() ) {
+    lowest_outstanding_ = next_sequence_number_ - packets_.capacity();
+  }
+}
+
+bool Scoreboard::acked( const uint64_t sequence_number, const uint64_t timestamp )
+{
+  SentPacketRing::Packet * const packet = packets_.lookup( sequence_number );
+  if ( not packet ) {
+    return false;
+  }
+
+  if ( packet->lost ) {
+    /* we gave up too soon (it was reordered or delayed, not lost) */
+    packet->lost = false;
+    spurious_++;
+  } else if ( packet->outstanding ) {
+    packets_.retire( *packet );
+    acked_++;
+  } else {
+    return false;
+  }
+
+  /* RACK follows the latest-sent datagram known to be delivered */
+  const uint64_t rtt = timestamp > packet->send_timestamp ? timestamp - packet->send_timestamp : 0;
+  min_rtt_ = min( min_rtt_, rtt );
+
+  if ( not rack_valid_ or packet->send_timestamp > rack_send_timestamp_
+       or (packet->send_timestamp == rack_send_timestamp_ and sequence_number > rack_sequence_number_) ) {
+    rack_sequence_number_ = sequence_number;
+    rack_send_timestamp_ = packet->send_timestamp;
+    rack_rtt_ = rtt;
+    rack_valid_ = true;
+  }
+
+  return true;
+}
+
+void Scoreboard::lose( SentPacketRing::Packet & packet )
+{
+  packets_.retire( packet );
+  packet.lost = true;
+  lost_++;
+  newly_lost_.push_back( packet.sequence_number );
+}
+
+/* move lowest_outstanding_ past datagrams that are acked or lost */
+void Scoreboard::skip_settled( void )
+{
+  while ( lowest_outstanding_ < next_sequence_number_
+	  and not packets_.find( lowest_outstanding_ ) ) {
+    lowest_outstanding_++;
+  }
+}
+
+const vector<uint64_t> & Scoreboard::detect_losses( const uint64_t now )
+{
+  newly_lost_.clear();
+  if ( not rack_valid_ ) {
+    return newly_lost_;
+  }
+
+  /* sends are in sequence order, so the deadlines are too: stop at the
+     first datagram whose time isn't up yet */
+  skip_settled();
+  for ( uint64_t seq = lowest_outstanding_; seq < rack_sequence_number_; seq++ ) {
+    SentPacketRing::Packet * const packet = packets_.find( seq );
+    if ( not packet ) {
+      continue;
+    }
+
+    if ( packet->send_timestamp + rack_rtt_ + reordering_window() > now ) {
+      break;
+    }
+
+    lose( *packet );
+  }
+
+  return newly_lost_;
+}
+
+uint64_t Scoreboard::loss_deadline( void )
+{
+  if ( not rack_valid_ ) {
+    return 0;
+  }
+
+  skip_settled();
+  if ( lowest_outstanding_ >= rack_sequence_number_ ) {
+    return 0;
+  }
+
+  const SentPacketRing::Packet * const packet = packets_.find( lowest_outstanding_ );
+  return packet->send_timestamp + rack_rtt_ + reordering_window();
+}
+
+const vector<uint64_t> & Scoreboard::lose_sent_before( const uint64_t cutoff )
+{
+  newly_lost_.clear();
+
+  skip_settled();
+  for ( uint64_t seq = lowest_outstanding_; seq < next_sequence_number_; seq++ ) {
+    SentPacketRing::Packet * const packet = packets_.find( seq );
+    if ( not packet ) {
+      continue;
+    }
+
+    if ( packet->send_timestamp >= cutoff ) {
+      break;
+    }
+
+    lose( *packet );
+  }
+
+  return newly_lost_;
+}
@@ -0,0 +1,74 @@
+#ifndef SCOREBOARD_HH
+#define SCOREBOARD_HH
+
+#include <cstdint>
+#include <vector>
+
+#include "sent_packet_ring.hh"
+
+/* The sender's view of every datagram: outstanding, acked, or lost.
+   Losses are found the RACK way (RFC 8985): once a datagram sent later
+   has been acked, an earlier one still unacked after an RTT plus a
+   reordering window is declared lost. Only outstanding datagrams count
+   as in flight, so losses and reordering don't shrink the window. */
+class Scoreboard
+{
+private:
+  SentPacketRing packets_;
+
+  uint64_t next_sequence_number_; /* one past the last datagram sent */
+  uint64_t lowest_outstanding_;   /* nothing below this is in flight */
+
+  /* the most recently sent datagram that has been acked */
+  uint64_t rack_sequence_number_;
+  uint64_t rack_send_timestamp_;
+  uint64_t rack_rtt_;
+  bool rack_valid_;
+
+  uint64_t min_rtt_;
+
+  /* the totals */
+  uint64_t acked_;
+  uint64_t lost_;
+  uint64_t spurious_; /* declared lost, then acked after all */
+
+  std::vector<uint64_t> newly_lost_;
+
+  uint64_t reordering_window( void ) const { return min_rtt_ / 4; }
+  void lose( SentPacketRing::Packet & packet );
+  void skip_settled( void );
+
+public:
+  Scoreboard( const unsigned int capacity_log2 = 16 );
+
+  /* a datagram was sent (sequence numbers increase, send times never decrease) */
+  void sent( const uint64_t sequence_number, const uint64_t send_timestamp,
+	     const uint32_t bytes );
+
+  /* an ack arrived at `timestamp`: returns false if it changed nothing
+     (a duplicate, or for a datagram long forgotten) */
+  bool acked( const uint64_t sequence_number, const uint64_t timestamp );
+
+  /* declare lost whatever RACK says is lost by `now`, and return those
+     sequence numbers (valid until the next call) */
+  const std::vector<uint64_t> & detect_losses( const uint64_t now );
+
+  /* when detect_losses() could next find something (0: not until another ack) */
+  uint64_t loss_deadline( void );
+
+  /* on a retransmission timeout: declare lost everything sent before `cutoff` */
+  const std::vector<uint64_t> & lose_sent_before( const uint64_t cutoff );
+
+  /* datagrams sent and neither acked nor lost */
+  size_t in_flight( void ) const { return packets_.outstanding(); }
+
+  /* nothing below this sequence number is still in flight */
+  uint64_t lowest_outstanding( void ) const { return lowest_outstanding_; }
+
+  uint64_t acked_count( void ) const { return acked_; }
+  uint64_t lost_count( void ) const { return lost_; }
+  uint64_t spurious_count( void ) const { return spurious_; }
+  uint64_t min_rtt( void ) const { return min_rtt_; }
+};
+
+#endif /* SCOREBOARD_HH */
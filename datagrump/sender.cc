@@ -1,33 +1,63 @@
 /* UDP sender for congestion-control contest */
 
 #include <cstdlib>
+#include <deque>
 #include <iostream>
+#include <memory>
+#include <vector>
 
 #include "socket.hh"
 #include "contest_message.hh"
-#include "controller.hh"
+#include "congestion_control.hh"
+#include "scoreboard.hh"
 #include "poller.hh"
+#include "timestamp.hh"
+#include "trace.hh"
 
 using namespace std;
 using namespace PollerShortNames;
 
-/* simple sender class to handle the accounting */
+/* simple sender class to handle the accounting
+   (built once for each congestion-control algorithm) */
+template <class ControllerType>
 class DatagrumpSender
 {
 private:
   UDPSocket socket_;
-  Controller controller_; /* your class */
+  UDPSocket::ReceiveBuffers ack_buffers_; /* acks land here in place */
+  bool use_gso_; /* hand bursts to the kernel as one segmented buffer */
+  ControllerType controller_; /* your class */
 
   uint64_t sequence_number_; /* next outgoing sequence number */
 
-  /* if network does not reorder or lose datagrams,
-     this is the sequence number that the sender
-     next expects will be acknowledged by the receiver */
-  uint64_t next_ack_expected_;
+  /* which datagrams are still in flight, and which were lost */
+  Scoreboard scoreboard_;
+
+  /* a pacing controller's next datagram may not leave before this */
+  uint64_t next_send_ns_;
+
+  /* one outgoing datagram (every one has the same dummy payload), and
+     space to write bursts of them, all reused so sending allocates nothing */
+  string datagram_;
+  string super_buffer_;
+  vector<string> wire_;
+
+  /* sends still waiting for their TX timestamp, oldest first, as the
+     range of sequence numbers [first, end) each one carried (only those
+     with datagrams in flight, so it can't grow without limit) */
+  deque<pair<uint64_t, uint64_t>> untimed_sends_;
+  uint32_t next_untimed_id_; /* the kernel's number for untimed_sends_.front() */
+  vector<UDPSocket::tx_timestamp> tx_timestamps_;
+
+  void sent( const uint64_t first, const uint64_t end );
+  void got_tx_timestamps( void );
 
   void send_datagram( void );
-  void got_ack( const uint64_t timestamp, const ContestMessage & msg );
+  void send_burst( void );
+  void got_ack( const uint64_t timestamp, const ContestMessage::Header & ack );
+  void lost( const vector<uint64_t> & sequence_numbers, const uint64_t timestamp );
   bool window_is_open( void );
+  bool pacing_allows_send( void );
 
 public:
   DatagrumpSender( const char * const host, const char * const port,
@@ -35,6 +65,29 @@ public:
   int loop( void );
 };
 
+static const char * const TRACE_FILENAME = "sender.trace";
+
+/* runs a sender with a particular kind of controller */
+template <class ControllerType>
+struct RunSender
+{
+  static int run( const char * const host, const char * const port, const bool debug )
+  {
+    /* in debug mode, the controller's per-packet events go to a
+       binary trace (written as it goes; read it with trace_decode) */
+    unique_ptr<TraceLog> trace_log;
+    if ( debug ) {
+      trace_log.reset( new TraceLog( TRACE_FILENAME ) );
+      cerr << "Tracing to " << TRACE_FILENAME << endl;
+    }
+
+    /* create sender object to handle the accounting */
+    /* all the interesting work is done by the Controller */
+    DatagrumpSender<ControllerType> sender( host, port, debug );
+    return sender.loop();
+  }
+};
+
 int main( int argc, char *argv[] )
 {
    /* check the command-line arguments */
@@ -43,31 +96,47 @@ int main( int argc, char *argv[] )
   }
 
   bool debug = false;
-  if ( argc == 4 and string( argv[ 3 ] ) == "debug" ) {
-    debug = true;
-  } else if ( argc == 3 ) {
-    /* do nothing */
-  } else {
-    cerr << "Usage: " << argv[ 0 ] << " HOST PORT [debug]" << endl;
+  string algorithm = "delay";
+  bool usage_error = argc < 3 or argc > 5;
+  for ( int i = 3; i < argc and not usage_error; i++ ) {
+    if ( string( argv[ i ] ) == "debug" ) {
+      debug = true;
+    } else if ( i == 3 ) {
+      algorithm = argv[ i ];
+    } else {
+      usage_error = true;
+    }
+  }
+
+  if ( usage_error ) {
+    cerr << "Usage: " << argv[ 0 ] << " HOST PORT [" << CONGESTION_CONTROL_NAMES << "] [debug]" << endl;
     return EXIT_FAILURE;
   }
 
-  /* create sender object to handle the accounting */
-  /* all the interesting work is done by the Controller */
-  DatagrumpSender sender( argv[ 1 ], argv[ 2 ], debug );
-  return sender.loop();
+  return run_with_congestion_control<RunSender>( algorithm, argv[ 1 ], argv[ 2 ], debug );
 }
 
-DatagrumpSender::DatagrumpSender( const char * const host,
-				  const char * const port,
-				  const bool debug )
+template <class ControllerType>
+DatagrumpSender<ControllerType>::DatagrumpSender( const char * const host,
+						  const char * const port,
+						  const bool debug )
   : socket_(),
+    ack_buffers_( 16 ),
+    use_gso_( false ),
     controller_( debug ),
     sequence_number_( 0 ),
-    next_ack_expected_( 0 )
+    scoreboard_(),
+    next_send_ns_( 0 ),
+    datagram_( ContestMessage( 0, string( 1424, 'x' ) ).to_string() ),
+    super_buffer_(),
+    wire_(),
+    untimed_sends_(),
+    next_untimed_id_( 0 ),
+    tx_timestamps_()
 {
-  /* turn on timestamps when socket receives a datagram */
-  socket_.set_timestamps();
+  /* turn on timestamps when socket receives a datagram,
+     and when each datagram actually leaves the host */
+  socket_.set_timestamping();
 
   /* connect socket to the remote host */
   /* (note: this doesn't send anything; it just tags the socket
@@ -75,80 +144,295 @@ DatagrumpSender::DatagrumpSender( const char * const host,
   socket_.connect( Address( host, port ) );  
 
   cerr << "Sending to " << socket_.peer_address().to_string() << endl;
+
+  use_gso_ = socket_.gso_supported();
+  if ( debug and not use_gso_ ) {
+    cerr << "UDP GSO unavailable, sending bursts with sendmmsg" << endl;
+  }
 }
 
-void DatagrumpSender::got_ack( const uint64_t timestamp,
-			       const ContestMessage & ack )
+template <class ControllerType>
+void DatagrumpSender<ControllerType>::got_ack( const uint64_t timestamp,
+			       const ContestMessage::Header & ack )
 {
   if ( not ack.is_ack() ) {
     throw runtime_error( "sender got something other than an ack from the receiver" );
   }
 
-  /* Update sender's counter */
-  next_ack_expected_ = max( next_ack_expected_,
-			    ack.header.ack_sequence_number + 1 );
+  /* Update the scoreboard (by the kernel's arrival time, like the controller) */
+  scoreboard_.acked( ack.ack_sequence_number, timestamp );
 
   /* Inform congestion controller */
-  controller_.ack_received( ack.header.ack_sequence_number,
-			    ack.header.ack_send_timestamp,
-			    ack.header.ack_recv_timestamp,
+  controller_.ack_received( ack.ack_sequence_number,
+			    ack.ack_send_timestamp,
+			    ack.ack_recv_timestamp,
 			    timestamp );
 }
 
-void DatagrumpSender::send_datagram( void )
+/* tell the controller which datagrams the scoreboard gave up on */
+template <class ControllerType>
+void DatagrumpSender<ControllerType>::lost( const vector<uint64_t> & sequence_numbers,
+					    const uint64_t timestamp )
+{
+  for ( const uint64_t seq : sequence_numbers ) {
+    controller_.datagram_was_lost( seq, timestamp );
+  }
+}
+
+/* one send() (or sendmmsg message, or GSO buffer) carried these datagrams */
+template <class ControllerType>
+void DatagrumpSender<ControllerType>::sent( const uint64_t first, const uint64_t end )
+{
+  untimed_sends_.emplace_back( first, end );
+
+  /* a timestamp for datagrams already acked or lost is no use, and the
+     kernel may never send one (or drop it), so don't wait for it */
+  while ( untimed_sends_.front().second <= scoreboard_.lowest_outstanding() ) {
+    untimed_sends_.pop_front();
+    next_untimed_id_++;
+  }
+}
+
+/* tell the controller when sent datagrams left the host */
+template <class ControllerType>
+void DatagrumpSender<ControllerType>::got_tx_timestamps( void )
+{
+  tx_timestamps_.clear();
+  socket_.recv_tx_timestamps( tx_timestamps_ );
+
+  for ( const auto & stamp : tx_timestamps_ ) {
+    const uint32_t offset = stamp.id - next_untimed_id_;
+    if ( offset >= untimed_sends_.size() ) {
+      continue; /* not a send we are waiting on */
+    }
+
+    /* the kernel may drop timestamps (if the error queue fills up) */
+    untimed_sends_.erase( untimed_sends_.begin(), untimed_sends_.begin() + offset );
+    next_untimed_id_ = stamp.id;
+
+    for ( uint64_t seq = untimed_sends_.front().first; seq < untimed_sends_.front().second; seq++ ) {
+      controller_.datagram_was_transmitted( seq, stamp.timestamp );
+    }
+
+    untimed_sends_.pop_front();
+    next_untimed_id_++;
+  }
+}
+
+template <class ControllerType>
+void DatagrumpSender<ControllerType>::send_datagram( void )
+{
+  ContestMessage::Header header( sequence_number_++ );
+  header.send_timestamp = timestamp_ns();
+
+  /* only the header changes from one datagram to the next */
+  header.serialize( datagram_ );
+  socket_.send( datagram_ );
+  sent( header.sequence_number, header.sequence_number + 1 );
+
+  /* Inform congestion controller */
+  scoreboard_.sent( header.sequence_number, header.send_timestamp, datagram_.size() );
+  controller_.datagram_was_sent( header.sequence_number,
+				 header.send_timestamp,
+				 datagram_.size() );
+}
+
+/* Fill the window, handing the whole burst to the kernel at once */
+template <class ControllerType>
+void DatagrumpSender<ControllerType>::send_burst( void )
 {
-  /* All messages use the same dummy payload */
-  static const string dummy_payload( 1424, 'x' );
+  /* the window only moves when an ack arrives, so size the burst once */
+  const uint64_t window = controller_.window_size();
+  const uint64_t in_flight = scoreboard_.in_flight();
+  if ( in_flight >= window ) {
+    return;
+  }
+
+  const uint64_t now = timestamp_ns();
+  const uint64_t first = sequence_number_;
+  uint64_t count = window - in_flight;
+
+  /* a pacing controller gets a short burst, then nothing more
+     until the burst has been paid for at its rate */
+  const uint64_t gap = controller_.pacing_gap_ns();
+  if ( gap ) {
+    if ( now < next_send_ns_ ) {
+      return;
+    }
+    count = paced_burst( count, gap );
+    next_send_ns_ = now + count * gap;
+  }
+
+  sequence_number_ += count;
+
+  /* the burst leaves in one go, so it shares one send timestamp */
+  ContestMessage::Header header( first );
+  header.send_timestamp = now;
 
-  ContestMessage cm( sequence_number_++, dummy_payload );
-  cm.set_send_timestamp();
-  socket_.send( cm.to_string() );
+  /* the payloads are already in place in the reused buffers;
+     each datagram only needs its header written in front */
+  if ( use_gso_ ) {
+    /* every datagram is the same size, so the kernel can cut
+       a concatenation of them back into datagrams */
+    const size_t segment_size = datagram_.size();
+    const size_t per_send = min( UDPSocket::MAX_GSO_SEGMENTS,
+				 UDPSocket::MAX_GSO_BYTES / segment_size );
+
+    for ( uint64_t i = 0; i < count; i += per_send ) {
+      const size_t segments = min( per_send, size_t( count - i ) );
+
+      /* (shrinking keeps the capacity, so regrowing doesn't allocate) */
+      if ( super_buffer_.size() > segments * segment_size ) {
+	super_buffer_.resize( segments * segment_size );
+      }
+      while ( super_buffer_.size() < segments * segment_size ) {
+	super_buffer_ += datagram_;
+      }
+
+      for ( size_t j = 0; j < segments; j++ ) {
+	header.sequence_number = first + i + j;
+	header.serialize( &super_buffer_[ j * segment_size ], segment_size );
+      }
+
+      socket_.send_segmented( super_buffer_, segment_size );
+      sent( first + i, first + i + segments );
+    }
+  } else {
+    while ( wire_.size() < count ) {
+      wire_.push_back( datagram_ );
+    }
+
+    for ( uint64_t i = 0; i < count; i++ ) {
+      header.sequence_number = first + i;
+      header.serialize( wire_[ i ] );
+    }
+
+    socket_.send_batch( wire_, count );
+    for ( uint64_t i = 0; i < count; i++ ) {
+      sent( first + i, first + i + 1 );
+    }
+  }
 
   /* Inform congestion controller */
-  controller_.datagram_was_sent( cm.header.sequence_number,
-				 cm.header.send_timestamp );
+  for ( uint64_t seq = first; seq < first + count; seq++ ) {
+    scoreboard_.sent( seq, header.send_timestamp, datagram_.size() );
+    controller_.datagram_was_sent( seq, header.send_timestamp, datagram_.size() );
+  }
+}
+
+template <class ControllerType>
+bool DatagrumpSender<ControllerType>::window_is_open( void )
+{
+  return scoreboard_.in_flight() < controller_.window_size();
 }
 
-bool DatagrumpSender::window_is_open( void )
+template <class ControllerType>
+bool DatagrumpSender<ControllerType>::pacing_allows_send( void )
 {
-  return sequence_number_ - next_ack_expected_ < controller_.window_size();
+  return controller_.pacing_gap_ns() == 0 or timestamp_ns() >= next_send_ns_;
 }
 
-int DatagrumpSender::loop( void )
+template <class ControllerType>
+int DatagrumpSender<ControllerType>::loop( void )
 {
   /* read and write from the receiver using an event-driven "poller" */
   Poller poller;
 
+  /* third rule (a timer): if no ack arrives for a while,
+     send one datagram to try to get things moving again */
+  Poller::TimerHandle timeout_timer;
+  function<void(void)> timed_out;
+  const auto restart_timeout_timer = [&] () {
+    poller.cancel_timer( timeout_timer );
+    timeout_timer = poller.add_timer( controller_.timeout_ms() * uint64_t( 1000000 ), timed_out );
+  };
+  timed_out = [&] () {
+    /* everything sent longer ago than the timeout is presumed lost */
+    const uint64_t now = timestamp_ns();
+    const uint64_t timeout_ns = controller_.timeout_ms() * uint64_t( 1000000 );
+    lost( scoreboard_.lose_sent_before( now > timeout_ns ? now - timeout_ns : 0 ), now );
+    send_datagram();
+    restart_timeout_timer();
+  };
+  timeout_timer = poller.add_timer( controller_.timeout_ms() * uint64_t( 1000000 ), timed_out );
+
+  /* fifth rule (a timer): if the window is open but pacing holds the
+     next burst back, wake up when it may go (the first rule sends it) */
+  bool pacing_timer_armed = false;
+  const auto schedule_paced_send = [&] () {
+    if ( pacing_timer_armed or not window_is_open() or pacing_allows_send() ) {
+      return;
+    }
+    pacing_timer_armed = true;
+    poller.add_timer( next_send_ns_ - timestamp_ns(),
+		      [&pacing_timer_armed] () { pacing_timer_armed = false; } );
+  };
+
+  /* sixth rule (a timer): a datagram that was overtaken by a later
+     one's ack is lost if it's still missing after RACK's deadline */
+  Poller::TimerHandle loss_timer = 0;
+  bool loss_timer_armed = false; /* (loss_timer means nothing until it is) */
+  function<void(void)> loss_timer_fired;
+  const auto detect_losses = [&] () {
+    const uint64_t now = timestamp_ns();
+    lost( scoreboard_.detect_losses( now ), now );
+
+    if ( loss_timer_armed ) {
+      poller.cancel_timer( loss_timer );
+      loss_timer_armed = false;
+    }
+
+    const uint64_t deadline = scoreboard_.loss_deadline();
+    if ( deadline ) {
+      loss_timer = poller.add_timer( deadline > now ? deadline - now : 0, loss_timer_fired );
+      loss_timer_armed = true;
+    }
+  };
+  loss_timer_fired = [&] () {
+    loss_timer_armed = false;
+    detect_losses();
+  };
+
   /* first rule: if the window is open, close it by
      sending more datagrams */
   poller.add_action( Action( socket_, Direction::Out, [&] () {
 	/* Close the window */
-	while ( window_is_open() ) {
-	  send_datagram();
-	}
+	send_burst();
+	schedule_paced_send();
 	return ResultType::Continue;
       },
-      /* We're only interested in this rule when the window is open */
-      [&] () { return window_is_open(); } ) );
+      /* We're only interested in this rule when the window is open
+	 (and the pacer would let another burst go) */
+      [&] () { return window_is_open() and pacing_allows_send(); } ) );
 
   /* second rule: if sender receives an ack,
      process it and inform the controller
      (by using the sender's got_ack method) */
   poller.add_action( Action( socket_, Direction::In, [&] () {
-	const UDPSocket::received_datagram recd = socket_.recv();
-	const ContestMessage ack  = recd.payload;
-	got_ack( recd.timestamp, ack );
+	const size_t count = socket_.recv_into( ack_buffers_ );
+	for ( size_t i = 0; i < count; i++ ) {
+	  /* only the header matters, so parse it in place */
+	  const ContestMessage::Header ack( ack_buffers_.payload( i ), ack_buffers_.payload_length( i ) );
+	  got_ack( ack_buffers_.timestamp( i ), ack );
+	}
+	detect_losses();
+	restart_timeout_timer();
+	schedule_paced_send();
+	return ResultType::Continue;
+      } ) );
+
+  /* fourth rule: when the kernel reports that datagrams have left
+     the host, tell the controller */
+  poller.add_action( Action( socket_, Direction::Error, [&] () {
+	got_tx_timestamps();
 	return ResultType::Continue;
       } ) );
 
-  /* Run these two rules forever */
+  /* Run these rules forever */
   while ( true ) {
-    const auto ret = poller.poll( controller_.timeout_ms() );
+    const auto ret = poller.poll( -1 );
     if ( ret.result == PollResult::Exit ) {
       return ret.exit_status;
-    } else if ( ret.result == PollResult::Timeout ) {
-      /* After a timeout, send one datagram to try to get things moving again */
-      send_datagram();
     }
   }
 }
@@ -0,0 +1,31 @@
+#include "sent_packet_ring.hh"
+
+using namespace std;
+
+/* room for 2^capacity_log2 packets in flight */
+SentPacketRing::SentPacketRing( const unsigned int capacity_log2 )
+  : slots_( size_t( 1 ) << capacity_log2, Packet { 0, 0, 0, 0, 0, false, false, false, 0, 0, 0 } ),
+    mask_( (uint64_t( 1 ) << capacity_log2) - 1 ),
+    outstanding_( 0 ),
+    evicted_( 0 )
+{}
+
+/* record a send */
+SentPacketRing::Packet & SentPacketRing::sent( const uint64_t sequence_number,
+					       const uint64_t send_timestamp,
+					       const uint32_t bytes )
+{
+  Packet & slot = slots_[ sequence_number & mask_ ];
+
+  /* a packet a whole ring ago that was never acked is given up on */
+  if ( slot.outstanding ) {
+    slot.outstanding = false;
+    outstanding_--;
+    evicted_++;
+  }
+
+  outstanding_++;
+  slot = Packet { sequence_number, send_timestamp, 0, bytes, uint32_t( outstanding_ ), false, true, false, 0, 0, 0 };
+
+  return slot;
+}
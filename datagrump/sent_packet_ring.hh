@@ -0,0 +1,81 @@
+#ifndef SENT_PACKET_RING_HH
+#define SENT_PACKET_RING_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/* What the sender remembers about each datagram it has sent, in a
+   fixed ring of slots indexed by sequence number: recording a send and
+   finding or retiring a packet are all O(1) and never allocate. */
+class SentPacketRing
+{
+public:
+  struct Packet
+  {
+    uint64_t sequence_number;
+    uint64_t send_timestamp; /* ns (see timestamp_ns()) */
+    uint64_t tx_timestamp;   /* when it left the host, if has_tx_timestamp */
+    uint32_t bytes;
+    uint32_t in_flight;      /* packets outstanding once it was sent (itself included) */
+    bool has_tx_timestamp;
+    bool outstanding;        /* sent, and not yet acked (or given up on) */
+    bool lost;               /* given up on (and no ack has turned up since) */
+
+    /* delivery-rate sampling state when it was sent (kept by the controller) */
+    uint64_t delivered;            /* packets acked by then */
+    uint64_t delivered_timestamp;  /* when the last of those was acked */
+    uint64_t first_sent_timestamp; /* send time of the packet that started the flight */
+  };
+
+private:
+  std::vector<Packet> slots_;
+  uint64_t mask_;
+  size_t outstanding_;
+  uint64_t evicted_;
+
+public:
+  /* room for 2^capacity_log2 packets in flight (all allocated up front) */
+  SentPacketRing( const unsigned int capacity_log2 = 16 );
+
+  size_t capacity( void ) const { return slots_.size(); }
+
+  /* packets sent and not yet acked */
+  size_t outstanding( void ) const { return outstanding_; }
+
+  /* packets pushed out of the ring while still outstanding (the sender
+     got more than capacity() ahead of its acks) */
+  uint64_t evicted( void ) const { return evicted_; }
+
+  /* record a send (sequence numbers may skip, but never go backwards
+     by capacity() or more); returns the new record */
+  Packet & sent( const uint64_t sequence_number, const uint64_t send_timestamp,
+		 const uint32_t bytes );
+
+  /* the outstanding packet with this sequence number, or nullptr if it
+     was never sent, is already acked (a duplicate), or is long gone */
+  Packet * find( const uint64_t sequence_number )
+  {
+    Packet & slot = slots_[ sequence_number & mask_ ];
+    return (slot.outstanding and slot.sequence_number == sequence_number) ? &slot : nullptr;
+  }
+
+  /* whatever the ring still holds for this sequence number, outstanding
+     or not (nullptr once the slot has gone to a later packet) */
+  Packet * lookup( const uint64_t sequence_number )
+  {
+    Packet & slot = slots_[ sequence_number & mask_ ];
+    return slot.sequence_number == sequence_number ? &slot : nullptr;
+  }
+
+  /* the packet is no longer in flight (acked, or given up on) */
+  void retire( Packet & packet )
+  {
+    if ( packet.outstanding ) {
+      packet.outstanding = false;
+      outstanding_--;
+    }
+  }
+};
+
+#endif /* SENT_PACKET_RING_HH */
@@ -0,0 +1,58 @@
+/* run a congestion controller over a mahimahi trace, in virtual time */
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+#include "congestion_control.hh"
+#include "simulator.hh"
+
+using namespace std;
+
+template <class ControllerType>
+struct RunSimulation
+{
+  static int run( const LinkTrace & uplink, const LinkTrace & downlink )
+  {
+    ControllerType controller( false );
+    Simulator<ControllerType> simulator( controller, CONTEST_PATH, uplink, &downlink );
+
+    const auto start = chrono::steady_clock::now();
+    const SimulationResult result = simulator.run();
+    const chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+    cout << fixed << setprecision( 2 );
+    cout << "Simulated " << result.duration_ns / 1.0e9 << " s in "
+	 << elapsed.count() << " s" << endl;
+    cout << "Average capacity: " << result.capacity_bytes * 8 * 1000.0 / result.duration_ns
+	 << " Mbits/s" << endl;
+    cout << "Average throughput: " << result.throughput_mbps() << " Mbits/s ("
+	 << 100 * result.utilization() << "% utilization)" << endl;
+    cout << "95th percentile one-way delay: " << result.p95_delay_ms << " ms" << endl;
+    cout << "Power (throughput/delay): " << result.power() << " Mbits/s^2" << endl;
+    cout << "Datagrams: " << result.sent << " sent, " << result.delivered << " delivered, "
+	 << result.lost << " declared lost, " << result.dropped << " dropped" << endl;
+
+    return EXIT_SUCCESS;
+  }
+};
+
+int main( int argc, char *argv[] )
+{
+   /* check the command-line arguments */
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  if ( argc != 3 and argc != 4 ) {
+    cerr << "Usage: " << argv[ 0 ] << " UPLINK_TRACE DOWNLINK_TRACE ["
+	 << CONGESTION_CONTROL_NAMES << "]" << endl;
+    return EXIT_FAILURE;
+  }
+
+  const LinkTrace uplink( argv[ 1 ] ), downlink( argv[ 2 ] );
+
+  return run_with_congestion_control<RunSimulation>( argc == 4 ? argv[ 3 ] : "delay",
+						      uplink, downlink );
+}
@@ -0,0 +1,299 @@
+#ifndef SIMULATOR_HH
+#define SIMULATOR_HH
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "congestion_control.hh"
+#include "contest_message.hh"
+#include "scoreboard.hh"
+#include "trace_link.hh"
+
+/* the emulated path (what run-contest builds with mm-delay and mm-link) */
+struct SimulatedPath
+{
+  uint64_t one_way_delay_ns;
+  size_t queue_limit;   /* uplink bottleneck queue, in packets (0: unlimited) */
+  uint64_t duration_ns; /* 0: once through the uplink trace (as mm-link --once) */
+};
+
+/* as run-contest: mm-delay 20 mm-link UPLINK DOWNLINK --once */
+static const SimulatedPath CONTEST_PATH = { 20 * uint64_t( 1000000 ), 0, 0 };
+
+/* what the receiver saw */
+struct SimulationResult
+{
+  uint64_t duration_ns;
+  uint64_t capacity_bytes;  /* what the uplink could have carried */
+  uint64_t delivered_bytes; /* what it did carry */
+  uint64_t sent, delivered, lost, dropped; /* datagrams (lost: per the sender's scoreboard) */
+  double p95_delay_ms;      /* one-way, sender to receiver */
+
+  double throughput_mbps( void ) const { return delivered_bytes * 8 * 1000.0 / duration_ns; }
+  double utilization( void ) const { return capacity_bytes ? double( delivered_bytes ) / capacity_bytes : 0; }
+
+  /* the contest's score: throughput over delay, in Mbit/s per second */
+  double power( void ) const { return p95_delay_ms > 0 ? throughput_mbps() / (p95_delay_ms / 1000) : 0; }
+};
+
+/* Runs a sender with a real controller over a trace-driven link, in
+   virtual time: the sender does what DatagrumpSender does (window,
+   pacing, loss detection and timeout), but every "wait" jumps the clock
+   straight to the next event, so minutes of link take well under a
+   second. The controller is only ever told virtual times. */
+template <class ControllerType>
+class Simulator
+{
+private:
+  static const uint64_t NEVER = std::numeric_limits<uint64_t>::max();
+
+  /* sizes of what the sender and receiver exchange (UDP payload, then as
+     mahimahi counts them, with IPv4 and UDP headers) */
+  static const uint32_t DATAGRAM_BYTES = ContestMessage::Header::SIZE + 1424;
+  static const uint32_t DATAGRAM_WIRE_BYTES = DATAGRAM_BYTES + 28;
+  static const uint32_t ACK_WIRE_BYTES = ContestMessage::Header::SIZE + 28;
+
+  struct InTransit
+  {
+    uint64_t arrival; /* ns */
+    uint64_t sequence_number;
+  };
+
+  ControllerType & controller_;
+  Scoreboard scoreboard_;
+  SimulatedPath path_;
+  TraceLink uplink_;
+  std::unique_ptr<TraceLink> downlink_; /* (without one, acks see only the delay) */
+
+  uint64_t now_;
+  uint64_t sequence_number_;
+  uint64_t next_send_ns_;
+  uint64_t timeout_at_;
+
+  /* per sequence number */
+  std::vector<uint64_t> send_timestamps_;
+  std::vector<uint64_t> recv_timestamps_;
+
+  std::deque<InTransit> to_receiver_, to_sender_;
+  std::vector<TraceLink::Packet> delivered_;
+  std::vector<uint64_t> acks_;
+
+  SimulationResult result_;
+  std::vector<uint64_t> delays_ns_;
+
+  void send( const uint64_t sequence_number )
+  {
+    send_timestamps_.push_back( now_ );
+    recv_timestamps_.push_back( 0 );
+    scoreboard_.sent( sequence_number, now_, DATAGRAM_BYTES );
+    controller_.datagram_was_sent( sequence_number, now_, DATAGRAM_BYTES );
+
+    if ( not uplink_.enqueue( sequence_number, DATAGRAM_WIRE_BYTES, now_ ) ) {
+      result_.dropped++;
+    }
+  }
+
+  /* as DatagrumpSender::send_burst() */
+  void send_burst( void )
+  {
+    const uint64_t window = controller_.window_size();
+    const uint64_t in_flight = scoreboard_.in_flight();
+    if ( in_flight >= window ) {
+      return;
+    }
+
+    uint64_t count = window - in_flight;
+    const uint64_t gap = controller_.pacing_gap_ns();
+    if ( gap ) {
+      if ( now_ < next_send_ns_ ) {
+	return;
+      }
+      count = paced_burst( count, gap );
+      next_send_ns_ = now_ + count * gap;
+    }
+
+    for ( uint64_t i = 0; i < count; i++ ) {
+      send( sequence_number_++ );
+    }
+  }
+
+  /* when a paced sender with an open window may send again */
+  uint64_t pacing_wakeup( void )
+  {
+    if ( controller_.pacing_gap_ns() == 0 or now_ >= next_send_ns_
+	 or scoreboard_.in_flight() >= controller_.window_size() ) {
+      return NEVER;
+    }
+    return next_send_ns_;
+  }
+
+  void lost( const std::vector<uint64_t> & sequence_numbers )
+  {
+    for ( const uint64_t seq : sequence_numbers ) {
+      controller_.datagram_was_lost( seq, now_ );
+    }
+  }
+
+  void restart_timeout( void )
+  {
+    timeout_at_ = now_ + controller_.timeout_ms() * uint64_t( 1000000 );
+  }
+
+  void timed_out( void )
+  {
+    const uint64_t timeout_ns = controller_.timeout_ms() * uint64_t( 1000000 );
+    lost( scoreboard_.lose_sent_before( now_ > timeout_ns ? now_ - timeout_ns : 0 ) );
+    send( sequence_number_++ );
+    restart_timeout();
+  }
+
+  /* the acks that reached the sender at now_, as one batch */
+  void got_acks( void )
+  {
+    for ( const uint64_t seq : acks_ ) {
+      scoreboard_.acked( seq, now_ );
+      controller_.ack_received( seq, send_timestamps_[ seq ], recv_timestamps_[ seq ], now_ );
+    }
+    acks_.clear();
+
+    lost( scoreboard_.detect_losses( now_ ) );
+    restart_timeout();
+  }
+
+  uint64_t loss_deadline( void )
+  {
+    const uint64_t deadline = scoreboard_.loss_deadline();
+    return deadline ? deadline : NEVER;
+  }
+
+  uint64_t next_event( void )
+  {
+    uint64_t next = std::min( { uplink_.next_delivery(), timeout_at_, loss_deadline(), pacing_wakeup() } );
+    if ( not to_receiver_.empty() ) {
+      next = std::min( next, to_receiver_.front().arrival );
+    }
+    if ( not to_sender_.empty() ) {
+      next = std::min( next, to_sender_.front().arrival );
+    }
+    if ( downlink_ ) {
+      next = std::min( next, downlink_->next_delivery() );
+    }
+    return next;
+  }
+
+  void step( void )
+  {
+    /* datagrams leave the bottleneck, and head for the receiver */
+    if ( uplink_.next_delivery() <= now_ ) {
+      delivered_.clear();
+      uplink_.deliver( delivered_ );
+      for ( const auto & packet : delivered_ ) {
+	result_.delivered_bytes += packet.size;
+	to_receiver_.push_back( InTransit { now_ + path_.one_way_delay_ns, packet.id } );
+      }
+    }
+
+    /* the receiver acks each datagram as it arrives */
+    while ( not to_receiver_.empty() and to_receiver_.front().arrival <= now_ ) {
+      const uint64_t seq = to_receiver_.front().sequence_number;
+      to_receiver_.pop_front();
+
+      recv_timestamps_[ seq ] = now_;
+      delays_ns_.push_back( now_ - send_timestamps_[ seq ] );
+      to_sender_.push_back( InTransit { now_ + path_.one_way_delay_ns, seq } );
+    }
+
+    /* acks come back (through the downlink, if there is one) */
+    while ( not to_sender_.empty() and to_sender_.front().arrival <= now_ ) {
+      const uint64_t seq = to_sender_.front().sequence_number;
+      to_sender_.pop_front();
+
+      if ( downlink_ ) {
+	downlink_->enqueue( seq, ACK_WIRE_BYTES, now_ );
+      } else {
+	acks_.push_back( seq );
+      }
+    }
+
+    if ( downlink_ and downlink_->next_delivery() <= now_ ) {
+      delivered_.clear();
+      downlink_->deliver( delivered_ );
+      for ( const auto & packet : delivered_ ) {
+	acks_.push_back( packet.id );
+      }
+    }
+
+    /* now the sender's rules, as in DatagrumpSender::loop() */
+    if ( not acks_.empty() ) {
+      got_acks();
+    }
+
+    if ( timeout_at_ <= now_ ) {
+      timed_out();
+    }
+
+    if ( loss_deadline() <= now_ ) {
+      lost( scoreboard_.detect_losses( now_ ) );
+    }
+
+    send_burst();
+  }
+
+public:
+  Simulator( ControllerType & controller, const SimulatedPath & path,
+	     const LinkTrace & uplink, const LinkTrace * const downlink = nullptr )
+    : controller_( controller ),
+      scoreboard_(),
+      path_( path ),
+      uplink_( uplink, path.queue_limit ),
+      downlink_( downlink ? new TraceLink( *downlink ) : nullptr ),
+      now_( 0 ),
+      sequence_number_( 0 ),
+      next_send_ns_( 0 ),
+      timeout_at_( NEVER ),
+      send_timestamps_(),
+      recv_timestamps_(),
+      to_receiver_(),
+      to_sender_(),
+      delivered_(),
+      acks_(),
+      result_(),
+      delays_ns_()
+  {
+    result_.duration_ns = path_.duration_ns ? path_.duration_ns : uplink.period_ms() * 1000000;
+  }
+
+  SimulationResult run( void )
+  {
+    restart_timeout();
+    send_burst();
+
+    while ( true ) {
+      const uint64_t next = next_event();
+      if ( next > result_.duration_ns ) {
+	break;
+      }
+      now_ = next;
+      step();
+    }
+
+    result_.capacity_bytes = uplink_.capacity_bytes( result_.duration_ns );
+    result_.sent = sequence_number_;
+    result_.delivered = delays_ns_.size();
+    result_.lost = scoreboard_.lost_count();
+
+    if ( not delays_ns_.empty() ) {
+      const auto p95 = delays_ns_.begin() + (delays_ns_.size() * 95) / 100;
+      std::nth_element( delays_ns_.begin(), p95, delays_ns_.end() );
+      result_.p95_delay_ms = *p95 / 1.0e6;
+    }
+
+    return result_;
+  }
+};
+
+#endif /* SIMULATOR_HH */
@@ -0,0 +1,107 @@
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+#include "trace_link.hh"
+
+using namespace std;
+
+LinkTrace::LinkTrace( const string & filename )
+  : opportunities_ms_()
+{
+  ifstream file( filename );
+  if ( not file ) {
+    throw runtime_error( "can't open trace " + filename );
+  }
+
+  string line;
+  while ( getline( file, line ) ) {
+    if ( line.empty() ) {
+      continue;
+    }
+
+    const uint64_t ms = stoull( line );
+    if ( not opportunities_ms_.empty() and ms < opportunities_ms_.back() ) {
+      throw runtime_error( filename + ": trace times must not decrease" );
+    }
+    opportunities_ms_.push_back( ms );
+  }
+
+  if ( opportunities_ms_.empty() or opportunities_ms_.back() == 0 ) {
+    throw runtime_error( filename + ": trace must last at least a millisecond" );
+  }
+}
+
+TraceLink::TraceLink( const LinkTrace & trace, const size_t queue_limit )
+  : trace_( trace ),
+    queue_limit_( queue_limit ),
+    queue_(),
+    next_index_( 0 ),
+    period_start_( 0 )
+{}
+
+void TraceLink::skip_opportunity( void )
+{
+  if ( ++next_index_ == trace_.opportunities_ms().size() ) {
+    next_index_ = 0;
+    period_start_ += trace_.period_ms() * 1000000;
+  }
+}
+
+bool TraceLink::enqueue( const uint64_t id, const uint32_t size, const uint64_t now )
+{
+  if ( queue_limit_ and queue_.size() >= queue_limit_ ) {
+    return false;
+  }
+
+  queue_.push_back( Packet { id, now, size, size } );
+  return true;
+}
+
+uint64_t TraceLink::next_delivery( void )
+{
+  if ( queue_.empty() ) {
+    return numeric_limits<uint64_t>::max();
+  }
+
+  /* opportunities that came while the queue was empty went unused */
+  while ( opportunity_ns() < queue_.front().enqueued ) {
+    skip_opportunity();
+  }
+
+  return opportunity_ns();
+}
+
+void TraceLink::deliver( vector<Packet> & delivered )
+{
+  const uint64_t now = next_delivery();
+  uint64_t credit = MTU;
+
+  while ( credit and not queue_.empty() and queue_.front().enqueued <= now ) {
+    Packet & head = queue_.front();
+    const uint32_t sent = min( uint64_t( head.bytes_left ), credit );
+    head.bytes_left -= sent;
+    credit -= sent;
+
+    if ( head.bytes_left == 0 ) {
+      delivered.push_back( head );
+      queue_.pop_front();
+    }
+  }
+
+  skip_opportunity();
+}
+
+uint64_t TraceLink::capacity_bytes( const uint64_t now ) const
+{
+  const uint64_t period_ns = trace_.period_ms() * 1000000;
+  const auto & opportunities = trace_.opportunities_ms();
+
+  /* whole periods, then the opportunities so far in this one */
+  const uint64_t into_period_ms = (now % period_ns) / 1000000;
+  const uint64_t count = (now / period_ns) * opportunities.size()
+    + (upper_bound( opportunities.begin(), opportunities.end(), into_period_ms ) - opportunities.begin());
+
+  return count * MTU;
+}
@@ -0,0 +1,76 @@
+#ifndef TRACE_LINK_HH
+#define TRACE_LINK_HH
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+/* A mahimahi packet-delivery trace: each line is a time, in
+   milliseconds, at which the link may deliver one MTU-sized packet.
+   The trace repeats, with a period of its last time. */
+class LinkTrace
+{
+private:
+  std::vector<uint64_t> opportunities_ms_;
+
+public:
+  LinkTrace( const std::string & filename );
+
+  /* when the link can deliver, within one period (sorted) */
+  const std::vector<uint64_t> & opportunities_ms( void ) const { return opportunities_ms_; }
+
+  uint64_t period_ms( void ) const { return opportunities_ms_.back(); }
+};
+
+/* The bottleneck queue of an mm-link, in virtual time: packets wait in a
+   FIFO (a drop-tail one, if it has a limit), and each of the trace's
+   delivery opportunities sends up to MTU bytes of them. A packet bigger
+   than what's left of an opportunity carries over into the next one. */
+class TraceLink
+{
+public:
+  static const uint64_t MTU = 1504; /* bytes per delivery opportunity (as in mahimahi) */
+
+  struct Packet
+  {
+    uint64_t id;       /* the caller's */
+    uint64_t enqueued; /* ns */
+    uint32_t size;     /* bytes */
+    uint32_t bytes_left;
+  };
+
+private:
+  const LinkTrace & trace_;
+  size_t queue_limit_; /* packets (0: unlimited) */
+
+  std::deque<Packet> queue_;
+  size_t next_index_;     /* of the next opportunity within the period */
+  uint64_t period_start_; /* ns */
+
+  uint64_t opportunity_ns( void ) const
+  {
+    return period_start_ + trace_.opportunities_ms()[ next_index_ ] * 1000000;
+  }
+
+  void skip_opportunity( void );
+
+public:
+  TraceLink( const LinkTrace & trace, const size_t queue_limit = 0 );
+
+  /* a packet arrives at the link at `now` (false: the queue was full, so it's dropped) */
+  bool enqueue( const uint64_t id, const uint32_t size, const uint64_t now );
+
+  /* when the queue's head will next move (UINT64_MAX: the queue is empty) */
+  uint64_t next_delivery( void );
+
+  /* use the opportunity at next_delivery(), appending what it finished delivering */
+  void deliver( std::vector<Packet> & delivered );
+
+  size_t queue_length( void ) const { return queue_.size(); }
+
+  /* how many bytes the link could have carried by `now` */
+  uint64_t capacity_bytes( const uint64_t now ) const;
+};
+
+#endif /* TRACE_LINK_HH */
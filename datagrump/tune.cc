@@ -0,0 +1,194 @@
+/* tune the delay-triggered controller's constants against local
+   mahimahi traces, simulating many configurations at once */
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "controller.hh"
+#include "runtime.hh"
+#include "simulator.hh"
+
+using namespace std;
+
+/* the constants to search over, and how far */
+struct Knob
+{
+  const char * name;
+  double Controller::Parameters::* member;
+  double min, max;
+};
+
+static const Knob KNOBS[] = {
+  { "alpha",            &Controller::Parameters::alpha,            0.01, 1 },
+  { "beta",             &Controller::Parameters::beta,             0.01, 1 },
+  { "min_rto_ms",       &Controller::Parameters::min_rto_ms,       10,   1000 },
+  { "max_rto_ms",       &Controller::Parameters::max_rto_ms,       100,  10000 },
+  { "delay_trigger_ms", &Controller::Parameters::delay_trigger_ms, 20,   1000 },
+  { "decrease_factor",  &Controller::Parameters::decrease_factor,  0.3,  0.99 },
+  { "fast_threshold",   &Controller::Parameters::fast_threshold,   0.05, 2 },
+  { "slow_threshold",   &Controller::Parameters::slow_threshold,   0.01, 2 },
+};
+
+/* coordinate descent: try each knob scaled by these, keep the best, repeat */
+static const double STEPS[] = { 0.5, 0.7, 0.85, 1.2, 1.4, 2 };
+static const unsigned int MAX_PASSES = 6;
+
+/* one configuration, over the whole corpus */
+struct Evaluation
+{
+  Controller::Parameters params;
+  double throughput_mbps; /* mean over the traces */
+  double delay_ms;        /* mean 95th-percentile one-way delay */
+  double score;           /* geometric mean of power */
+};
+
+/* simulate every configuration on every trace, spread over all cores */
+static vector<Evaluation> evaluate( const vector<Controller::Parameters> & candidates,
+				    const vector<LinkTrace> & traces )
+{
+  vector<SimulationResult> results( candidates.size() * traces.size() );
+  atomic<size_t> next_job( 0 );
+
+  {
+    Runtime runtime;
+    for ( size_t i = 0; i < runtime.size(); i++ ) {
+      /* each worker takes the next job until there are none left */
+      runtime.worker( i ).post( [&] ( Runtime::Worker & ) {
+	  for ( size_t job; (job = next_job++) < results.size(); ) {
+	    Controller controller( false, candidates[ job / traces.size() ] );
+	    Simulator<Controller> simulator( controller, CONTEST_PATH, traces[ job % traces.size() ] );
+	    results[ job ] = simulator.run();
+	  }
+	} );
+    }
+    runtime.stop(); /* (after the jobs, which were posted first) */
+  }
+
+  vector<Evaluation> evaluations;
+  for ( size_t c = 0; c < candidates.size(); c++ ) {
+    Evaluation evaluation { candidates[ c ], 0, 0, 0 };
+    double log_power = 0;
+    for ( size_t t = 0; t < traces.size(); t++ ) {
+      const SimulationResult & result = results[ c * traces.size() + t ];
+      evaluation.throughput_mbps += result.throughput_mbps() / traces.size();
+      evaluation.delay_ms += result.p95_delay_ms / traces.size();
+      log_power += log( max( result.power(), 1e-9 ) ) / traces.size();
+    }
+    evaluation.score = exp( log_power );
+    evaluations.push_back( evaluation );
+  }
+
+  return evaluations;
+}
+
+/* a column wide enough for the knob's name and its value */
+static int width( const Knob & knob )
+{
+  return max( string( knob.name ).size(), size_t( 9 ) );
+}
+
+static void print_header( void )
+{
+  cout << setw( 10 ) << "Mbit/s" << setw( 10 ) << "p95 ms" << setw( 10 ) << "power";
+  for ( const Knob & knob : KNOBS ) {
+    cout << "  " << setw( width( knob ) ) << knob.name;
+  }
+  cout << endl;
+}
+
+static void print( const Evaluation & evaluation )
+{
+  cout << fixed << setprecision( 2 )
+       << setw( 10 ) << evaluation.throughput_mbps
+       << setw( 10 ) << evaluation.delay_ms
+       << setw( 10 ) << evaluation.score;
+  cout << setprecision( 4 );
+  for ( const Knob & knob : KNOBS ) {
+    cout << "  " << setw( width( knob ) ) << evaluation.params.*knob.member;
+  }
+  cout << endl;
+}
+
+int main( int argc, char *argv[] )
+{
+   /* check the command-line arguments */
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  if ( argc < 2 ) {
+    cerr << "Usage: " << argv[ 0 ] << " UPLINK_TRACE [UPLINK_TRACE...]" << endl;
+    return EXIT_FAILURE;
+  }
+
+  /* the corpus (acks come back over the delay alone, with no downlink trace) */
+  vector<LinkTrace> traces;
+  for ( int i = 1; i < argc; i++ ) {
+    traces.emplace_back( argv[ i ] );
+  }
+
+  /* every configuration tried, for the frontier */
+  vector<Evaluation> tried = evaluate( { Controller::Parameters() }, traces );
+  Evaluation best = tried.front();
+  cerr << "defaults: power " << best.score << endl;
+
+  for ( unsigned int pass = 1; pass <= MAX_PASSES; pass++ ) {
+    bool improved = false;
+
+    for ( const Knob & knob : KNOBS ) {
+      vector<Controller::Parameters> candidates;
+      for ( const double step : STEPS ) {
+	Controller::Parameters params = best.params;
+	params.*knob.member = min( max( params.*knob.member * step, knob.min ), knob.max );
+	if ( params.*knob.member != best.params.*knob.member ) {
+	  candidates.push_back( params );
+	}
+      }
+
+      const vector<Evaluation> evaluations = evaluate( candidates, traces );
+      tried.insert( tried.end(), evaluations.begin(), evaluations.end() );
+
+      for ( const Evaluation & evaluation : evaluations ) {
+	if ( evaluation.score > best.score * 1.0001 ) {
+	  best = evaluation;
+	  improved = true;
+	  cerr << "pass " << pass << ", " << knob.name << " = " << best.params.*knob.member
+	       << ": power " << best.score << endl;
+	}
+      }
+    }
+
+    if ( not improved ) {
+      break;
+    }
+  }
+
+  /* the configurations no other beats on both throughput and delay */
+  sort( tried.begin(), tried.end(),
+	[] ( const Evaluation & a, const Evaluation & b ) {
+	  return a.throughput_mbps != b.throughput_mbps
+	    ? a.throughput_mbps > b.throughput_mbps : a.delay_ms < b.delay_ms;
+	} );
+
+  cout << "Pareto frontier of " << tried.size() << " configurations over "
+       << traces.size() << " traces:" << endl;
+  print_header();
+  double lowest_delay = INFINITY;
+  for ( const Evaluation & evaluation : tried ) {
+    if ( evaluation.delay_ms < lowest_delay ) {
+      lowest_delay = evaluation.delay_ms;
+      print( evaluation );
+    }
+  }
+
+  cout << endl << "Best power:" << endl;
+  print_header();
+  print( best );
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,75 @@
+#ifndef WINDOWED_FILTER_HH
+#define WINDOWED_FILTER_HH
+
+#include <cstdint>
+
+/* The best (e.g. largest, with Better = std::greater_equal) value seen
+   over a sliding window of time or round trips, tracked in constant space
+   by keeping the best, second-best and third-best samples from successive
+   parts of the window (Kathleen Nichols' algorithm, as used by BBR). */
+template <typename Value, typename Better>
+class WindowedFilter
+{
+private:
+  struct Sample
+  {
+    uint64_t time;
+    Value value;
+  };
+
+  uint64_t window_;
+  Sample samples_[ 3 ];
+  Better better_;
+
+  void reset( const Sample & sample )
+  {
+    samples_[ 0 ] = samples_[ 1 ] = samples_[ 2 ] = sample;
+  }
+
+public:
+  WindowedFilter( const uint64_t window, const Value initial )
+    : window_( window ),
+      samples_{ { 0, initial }, { 0, initial }, { 0, initial } },
+      better_()
+  {}
+
+  /* best value in the window */
+  Value best( void ) const { return samples_[ 0 ].value; }
+
+  /* add a measurement (times must not go backwards) */
+  void update( const uint64_t time, const Value value )
+  {
+    const Sample sample = { time, value };
+
+    if ( better_( value, samples_[ 0 ].value ) or time - samples_[ 2 ].time > window_ ) {
+      reset( sample );
+      return;
+    }
+
+    if ( better_( value, samples_[ 1 ].value ) ) {
+      samples_[ 1 ] = samples_[ 2 ] = sample;
+    } else if ( better_( value, samples_[ 2 ].value ) ) {
+      samples_[ 2 ] = sample;
+    }
+
+    /* age out the best sample once it leaves the window, and keep
+       the others spread across the window */
+    const uint64_t elapsed = time - samples_[ 0 ].time;
+    if ( elapsed > window_ ) {
+      samples_[ 0 ] = samples_[ 1 ];
+      samples_[ 1 ] = samples_[ 2 ];
+      samples_[ 2 ] = sample;
+      if ( time - samples_[ 0 ].time > window_ ) {
+	samples_[ 0 ] = samples_[ 1 ];
+	samples_[ 1 ] = samples_[ 2 ];
+	samples_[ 2 ] = sample;
+      }
+    } else if ( samples_[ 1 ].time == samples_[ 0 ].time and elapsed > window_ / 4 ) {
+      samples_[ 2 ] = samples_[ 1 ] = sample;
+    } else if ( samples_[ 2 ].time == samples_[ 1 ].time and elapsed > window_ / 2 ) {
+      samples_[ 2 ] = sample;
+    }
+  }
+};
+
+#endif /* WINDOWED_FILTER_HH */
@@ -4,6 +4,7 @@
 #include "socket.hh"
 #include "util.hh"
 #include "poller.hh"
+#include "ring_buffer.hh"
 
 using namespace std;
 using namespace PollerShortNames;
@@ -38,11 +39,16 @@ int main( int argc, char *argv[] )
   /* now read and write from the server using an event-driven "poller" */
   Poller poller;
 
+  /* (what arrives is read into this, in place) */
+  RingBuffer incoming;
+
   /* first rule: if the socket has data ready (in the "In" direction),
      print it to the screen (cout) */
   poller.add_action( Action( socket, Direction::In,
 			     [&] () {
-			       cout << socket.read();
+			       socket.read_into( incoming ).check( "read" );
+			       cout.write( incoming.data(), incoming.size() );
+			       incoming.consume( incoming.size() );
 
 			       /* exit if the server closes the connection */
 			       if ( socket.eof() ) {
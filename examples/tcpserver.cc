@@ -1,14 +1,59 @@
 /* simple TCP listener/server to demonstrate sourdough starter classes */
 /* Keith Winstein <keithw@cs.stanford.edu>, January 2015 */
 
-#include <thread>
+#include <cstring>
 #include <iostream>
 
-#include "socket.hh"
+#include "framing.hh"
+#include "tcp_server.hh"
 #include "util.hh"
 
 using namespace std;
 
+/* Print every line that the client sends, and tell it how long it was */
+class PrintingConnection : public TCPConnection
+{
+private:
+  string peer_;
+  RingBuffer input_; /* what has arrived, up to the end of the last whole line */
+
+public:
+  PrintingConnection() : peer_(), input_( 4096 ) {}
+
+  void opened( void ) override
+  {
+    peer_ = socket().peer_address().to_string();
+    input_.consume( input_.size() );
+    cerr << "New connection from " << peer_
+	 << " (worker " << worker().index() << ")" << endl;
+  }
+
+  void readable( void ) override
+  {
+    /* take everything that has arrived, a line at a time (a line too
+       long for the buffer closes the connection), unless the client
+       has fallen so far behind on the replies that the output paused */
+    while ( not output().paused() ) {
+      const IOResult result = socket().read_into( input_ );
+      if ( result.would_block() ) {
+	break;
+      } else if ( result.eof() or result.failed() ) {
+	cerr << peer_ << " closed the connection"
+	     << (result.failed() ? string( " (" ) + strerror( result.error ) + ")" : "") << "." << endl;
+	close(); /* also removes this connection's actions */
+	return;
+      }
+
+      extract_lines( input_, [this] ( const char * const line, const size_t length ) {
+	  cerr << "Got a line of " << length << " bytes from " << peer_ << ": ";
+	  cerr.write( line, length ) << endl;
+	  output().push( "Received " + to_string( length ) + " bytes from you.\n" );
+	} );
+    }
+    /* (the replies all go out together, once this returns) */
+  }
+};
+
 int main( int argc, char *argv[] )
 {
   /* check the command-line arguments */
@@ -21,49 +66,18 @@ int main( int argc, char *argv[] )
     return EXIT_FAILURE;
   }
 
-  /* create a TCP socket */
-  TCPSocket listening_socket;
-
-  /* it's ok to reuse the server's address as soon as the program quits
-     (this helps debugging, at the slight cost to robustness) */
-  listening_socket.set_reuseaddr();
-
-  /* "bind" the socket to the user-specified local port number */
-  listening_socket.bind( Address( "::0", argv[ 1 ] ) );
+  /* listen on the user-specified local port number, with one event
+     loop per core; each accepts and serves its own share of the
+     clients, and every client gets a PrintingConnection (reused
+     once that client is gone) */
+  TCPServer server( Address( "::0", argv[ 1 ] ),
+		    [] () -> TCPConnection * { return new PrintingConnection; } );
 
-  /* mark the socket as listening for incoming connections */
-  listening_socket.listen();
-  cerr << "Listening on local address: " << listening_socket.local_address().to_string() << endl;
+  cerr << "Listening on local address: " << server.local_address().to_string() << endl;
+  cerr << "Serving with " << server.size() << " worker threads" << endl;
 
-  /* Wait for clients to connect */
-  while ( true ) {
-
-    /* This line does a lot. It waits for a client to connect
-       ("listening_socket.accept()"). When that returns a new socket,
-       it starts a thread to handle that client and passes in the
-       result of accept() as the "client" parameter to the handler. */
-
-    thread client_handler( [] ( TCPSocket client ) {
-	cerr << "New connection from " << client.peer_address().to_string() << endl;
-
-	/* Print every line that the client sends */
-	while ( true ) {
-	  const string chunk = client.read();
-	  if ( client.eof() ) { break; }
-	  cerr << "Got " << chunk.size() << " bytes from "
-	       << client.peer_address().to_string() << ": " << chunk;
-	  client.write( "Received " + to_string( chunk.size() ) + " bytes from you.\n" );
-	}
-
-	cerr << client.peer_address().to_string() << " closed the connection." << endl; 
-      }, listening_socket.accept() );
-
-    /* Let the client handler continue to run without having
-       to keep track of it. The main thread can go back to accepting
-       new incoming connections. */
-
-    client_handler.detach();
-  }
+  /* serve until the workers stop */
+  server.wait();
 
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,112 @@
+#ifndef DELEGATE_HH
+#define DELEGATE_HH
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/* Delegate: like std::function, but the callable always lives inline
+   (in Capacity bytes), so constructing or copying one never allocates.
+   A callable that doesn't fit is a compile-time error. */
+template <typename Signature, size_t Capacity = 48> class Delegate;
+
+template <typename R, typename... Args, size_t Capacity>
+class Delegate<R(Args...), Capacity>
+{
+private:
+  typedef typename std::aligned_storage<Capacity, alignof( std::max_align_t )>::type Storage;
+
+  typedef R (*Invoker)( void * callable, Args... args );
+  typedef void (*Copier)( void * destination, const void * source );
+  typedef void (*Destroyer)( void * callable );
+
+  mutable Storage storage_;
+  Invoker invoke_;
+  Copier copy_;
+  Destroyer destroy_;
+
+  template <typename F>
+  static R invoke_as( void * callable, Args... args )
+  {
+    return (*static_cast<F *>( callable ))( std::forward<Args>( args )... );
+  }
+
+  template <typename F>
+  static void copy_as( void * destination, const void * source )
+  {
+    new (destination) F( *static_cast<const F *>( source ) );
+  }
+
+  template <typename F>
+  static void destroy_as( void * callable )
+  {
+    static_cast<F *>( callable )->~F();
+  }
+
+  void reset( void )
+  {
+    if ( destroy_ ) {
+      destroy_( &storage_ );
+    }
+    invoke_ = nullptr;
+    copy_ = nullptr;
+    destroy_ = nullptr;
+  }
+
+public:
+  /* empty delegate */
+  Delegate() : storage_(), invoke_( nullptr ), copy_( nullptr ), destroy_( nullptr ) {}
+  Delegate( std::nullptr_t ) : Delegate() {}
+
+  /* wrap any callable (lambda, function pointer, functor) that fits */
+  template <typename F,
+	    typename = typename std::enable_if<not std::is_same<typename std::decay<F>::type,
+								 Delegate>::value>::type>
+  Delegate( F && callable )
+    : storage_(), invoke_( nullptr ), copy_( nullptr ), destroy_( nullptr )
+  {
+    typedef typename std::decay<F>::type Callable;
+    static_assert( sizeof( Callable ) <= Capacity, "Delegate: callable too big for inline storage" );
+    static_assert( alignof( Callable ) <= alignof( std::max_align_t ), "Delegate: callable over-aligned" );
+
+    new (&storage_) Callable( std::forward<F>( callable ) );
+    invoke_ = &invoke_as<Callable>;
+    copy_ = &copy_as<Callable>;
+    destroy_ = &destroy_as<Callable>;
+  }
+
+  Delegate( const Delegate & other )
+    : storage_(), invoke_( other.invoke_ ), copy_( other.copy_ ), destroy_( other.destroy_ )
+  {
+    if ( copy_ ) {
+      copy_( &storage_, &other.storage_ );
+    }
+  }
+
+  Delegate & operator=( const Delegate & other )
+  {
+    if ( this != &other ) {
+      reset();
+      if ( other.copy_ ) {
+	other.copy_( &storage_, &other.storage_ );
+      }
+      invoke_ = other.invoke_;
+      copy_ = other.copy_;
+      destroy_ = other.destroy_;
+    }
+    return *this;
+  }
+
+  ~Delegate() { reset(); }
+
+  explicit operator bool( void ) const { return invoke_ != nullptr; }
+
+  /* call the wrapped callable (which must not be empty) */
+  R operator()( Args... args ) const
+  {
+    return invoke_( &storage_, std::forward<Args>( args )... );
+  }
+};
+
+#endif /* DELEGATE_HH */
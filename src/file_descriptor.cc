@@ -1,6 +1,8 @@
 #include "file_descriptor.hh"
+#include "ring_buffer.hh"
 #include "util.hh"
 
+#include <fcntl.h>
 #include <unistd.h>
 
 using namespace std;
@@ -10,7 +12,9 @@ FileDescriptor::FileDescriptor( const int fd )
   : fd_( fd ),
     eof_( false ),
     read_count_( 0 ),
-    write_count_( 0 )
+    write_count_( 0 ),
+    close_hooks_(),
+    next_close_hook_( 0 )
 {}
 
 /* move constructor */
@@ -18,7 +22,9 @@ FileDescriptor::FileDescriptor( FileDescriptor && other )
   : fd_( other.fd_ ),
     eof_( other.eof_ ),
     read_count_( other.read_count_ ),
-    write_count_( other.write_count_ )
+    write_count_( other.write_count_ ),
+    close_hooks_(), /* hooks stay with the other object, which is what they refer to */
+    next_close_hook_( 0 )
 {
   /* mark other file descriptor as inactive */
   other.fd_ = -1;
@@ -27,6 +33,17 @@ FileDescriptor::FileDescriptor( FileDescriptor && other )
 /* destructor */
 FileDescriptor::~FileDescriptor()
 {
+  /* hooks may remove themselves, so run them from a copy */
+  vector<pair<uint64_t, Delegate<void(void)>>> hooks;
+  swap( hooks, close_hooks_ );
+  for ( const auto & hook : hooks ) {
+    try {
+      hook.second();
+    } catch ( const exception & e ) { /* don't throw from destructor */
+      print_exception( e );
+    }
+  }
+
   if ( fd_ < 0 ) { /* has already been moved away */
     return;
   }
@@ -38,6 +55,51 @@ FileDescriptor::~FileDescriptor()
   }
 }
 
+/* run `hook` just before this object is destroyed */
+uint64_t FileDescriptor::add_close_hook( const Delegate<void(void)> & hook )
+{
+  close_hooks_.emplace_back( next_close_hook_, hook );
+  return next_close_hook_++;
+}
+
+void FileDescriptor::remove_close_hook( const uint64_t id )
+{
+  for ( auto it = close_hooks_.begin(); it != close_hooks_.end(); ++it ) {
+    if ( it->first == id ) {
+      close_hooks_.erase( it );
+      return;
+    }
+  }
+}
+
+IOResult IOResult::from_return( const ssize_t return_value )
+{
+  if ( return_value >= 0 ) {
+    return IOResult( Status::Done, return_value );
+  } else if ( errno == EAGAIN or errno == EWOULDBLOCK ) {
+    return IOResult( Status::WouldBlock );
+  } else {
+    return IOResult( Status::Error, 0, errno );
+  }
+}
+
+const IOResult & IOResult::check( const char * const attempt ) const
+{
+  if ( failed() ) {
+    throw unix_error( attempt, error );
+  } else if ( would_block() ) {
+    throw unix_error( attempt, EAGAIN );
+  }
+  return *this;
+}
+
+/* turn O_NONBLOCK off or on */
+void FileDescriptor::set_blocking( const bool blocking )
+{
+  const int flags = SystemCall( "fcntl", fcntl( fd_, F_GETFL ) );
+  SystemCall( "fcntl", fcntl( fd_, F_SETFL, blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK) ) );
+}
+
 /* attempt to write a portion of a string */
 string::const_iterator FileDescriptor::write( const string::const_iterator & begin,
 					      const string::const_iterator & end )
@@ -71,6 +133,85 @@ string FileDescriptor::read( const size_t limit )
   return string( buffer, bytes_read );
 }
 
+/* read without throwing */
+IOResult FileDescriptor::read_some( char * const buffer, const size_t length )
+{
+  register_read(); /* (even if nothing was ready, for Poller's busy-wait check) */
+
+  ssize_t bytes_read;
+  do {
+    bytes_read = ::read( fd_, buffer, length );
+  } while ( bytes_read < 0 and errno == EINTR );
+
+  if ( bytes_read == 0 and length > 0 ) {
+    set_eof();
+    return IOResult( IOResult::Status::Eof );
+  }
+
+  return IOResult::from_return( bytes_read );
+}
+
+/* read in place, without throwing */
+IOResult FileDescriptor::read_into( RingBuffer & buffer )
+{
+  if ( buffer.room() == 0 ) {
+    register_read();
+    return IOResult( IOResult::Status::Done, 0 );
+  }
+
+  const IOResult result = read_some( buffer.space(), buffer.room() );
+  if ( result.done() ) {
+    buffer.produce( result.count );
+  }
+  return result;
+}
+
+/* move bytes inside the kernel, without throwing */
+IOResult FileDescriptor::splice_to( FileDescriptor & destination, const size_t length )
+{
+  register_read();
+  destination.register_write();
+
+  ssize_t moved;
+  do {
+    moved = splice( fd_, nullptr, destination.fd_, nullptr, length,
+		    SPLICE_F_MOVE | SPLICE_F_NONBLOCK );
+  } while ( moved < 0 and errno == EINTR );
+
+  if ( moved == 0 and length > 0 ) {
+    set_eof();
+    return IOResult( IOResult::Status::Eof );
+  }
+
+  return IOResult::from_return( moved );
+}
+
+/* write without throwing */
+IOResult FileDescriptor::write_some( const char * const data, const size_t length )
+{
+  register_write();
+
+  ssize_t bytes_written;
+  do {
+    bytes_written = ::write( fd_, data, length );
+  } while ( bytes_written < 0 and errno == EINTR );
+
+  return IOResult::from_return( bytes_written );
+}
+
+/* gather-write without throwing */
+IOResult FileDescriptor::write_some( const iovec * const buffers, const size_t count )
+{
+  register_write();
+
+  ssize_t bytes_written;
+  do {
+    bytes_written = ::writev( fd_, buffers, count );
+  } while ( bytes_written < 0 and errno == EINTR );
+
+  return IOResult::from_return( bytes_written );
+}
+
 /* write method */
 string::const_iterator FileDescriptor::write( const std::string & buffer, const bool write_all )
 {
@@ -1,7 +1,43 @@
 #ifndef FILE_DESCRIPTOR_HH
 #define FILE_DESCRIPTOR_HH
 
+#include <cstddef>
 #include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "delegate.hh"
+
+class RingBuffer;
+
+/* What a nonblocking operation did. The failures a nonblocking caller
+   expects (nothing ready yet, the other end gone) come back as a status
+   instead of an exception, so a loop can drain an fd until WouldBlock
+   without unwinding. */
+struct IOResult
+{
+  enum class Status { Done, WouldBlock, Eof, Error } status;
+  size_t count; /* Done: bytes (or datagrams, or connections) */
+  int error;    /* Error: the errno */
+
+  IOResult( const Status s_status, const size_t s_count = 0, const int s_error = 0 )
+    : status( s_status ), count( s_count ), error( s_error ) {}
+
+  bool done( void ) const { return status == Status::Done; }
+  bool would_block( void ) const { return status == Status::WouldBlock; }
+  bool eof( void ) const { return status == Status::Eof; }
+  bool failed( void ) const { return status == Status::Error; }
+
+  /* from a syscall's return value (and errno), e.g. read's */
+  static IOResult from_return( const ssize_t return_value );
+
+  /* for callers that want the throwing behavior: unix_error for
+     Error, or for WouldBlock (as EAGAIN) */
+  const IOResult & check( const char * const attempt ) const;
+};
 
 /* Unix file descriptors (sockets, files, etc.) */
 class FileDescriptor
@@ -12,6 +48,10 @@ private:
 
   unsigned int read_count_, write_count_;
 
+  /* callbacks to run just before this object goes away */
+  std::vector<std::pair<uint64_t, Delegate<void(void)>>> close_hooks_;
+  uint64_t next_close_hook_;
+
   /* attempt to write a portion of a string */
   std::string::const_iterator write( const std::string::const_iterator & begin,
 				     const std::string::const_iterator & end );
@@ -40,10 +80,37 @@ public:
   unsigned int read_count( void ) const { return read_count_; }
   unsigned int write_count( void ) const { return write_count_; }
 
+  /* run `hook` just before this object is destroyed (e.g. so a Poller
+     can forget about it); returns an id for remove_close_hook() */
+  uint64_t add_close_hook( const Delegate<void(void)> & hook );
+  void remove_close_hook( const uint64_t id );
+
+  /* a nonblocking fd fails with EAGAIN instead of waiting */
+  void set_blocking( const bool blocking );
+
   /* read and write methods */
   std::string read( const size_t limit = BUFFER_SIZE );
   std::string::const_iterator write( const std::string & buffer, const bool write_all = true );
 
+  /* read or write as much as the fd will take right now, without
+     throwing (on a nonblocking fd, WouldBlock instead of waiting).
+     A read of nothing is Eof, and sets eof() as read() does. */
+  IOResult read_some( char * const buffer, const size_t length );
+  IOResult write_some( const char * const data, const size_t length );
+  IOResult write_some( const std::string & buffer ) { return write_some( buffer.data(), buffer.size() ); }
+
+  /* gather-write several buffers with one syscall (writev) */
+  IOResult write_some( const iovec * const buffers, const size_t count );
+
+  /* read_some() straight into the free space of `buffer` (Done with
+     a count of 0 if it has none: consume some first) */
+  IOResult read_into( RingBuffer & buffer );
+
+  /* move up to `length` bytes from this fd to `destination` without
+     copying them through user space (splice: one of the two must be a
+     pipe, and a socket must be nonblocking for this not to wait) */
+  IOResult splice_to( FileDescriptor & destination, const size_t length );
+
   /* forbid copying FileDescriptor objects or assigning them */
   FileDescriptor( const FileDescriptor & other ) = delete;
   const FileDescriptor & operator=( const FileDescriptor & other ) = delete;
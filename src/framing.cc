@@ -0,0 +1,63 @@
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <endian.h>
+
+#include "framing.hh"
+
+using namespace std;
+
+size_t extract_lines( RingBuffer & buffer, const FrameHandler & frame )
+{
+  size_t count = 0;
+
+  while ( not buffer.empty() ) {
+    const char * const line = buffer.data();
+    const char * const newline = static_cast<const char *>( memchr( line, '\n', buffer.size() ) );
+    if ( not newline ) {
+      if ( buffer.room() == 0 ) {
+	throw runtime_error( "line longer than " + to_string( buffer.capacity() ) + " bytes" );
+      }
+      break;
+    }
+
+    size_t length = newline - line;
+    if ( length > 0 and line[ length - 1 ] == '\r' ) {
+      length--;
+    }
+
+    frame( line, length );
+    buffer.consume( newline - line + 1 );
+    count++;
+  }
+
+  return count;
+}
+
+size_t extract_length_prefixed( RingBuffer & buffer, const FrameHandler & frame,
+				const uint32_t max_length )
+{
+  static const size_t PREFIX = sizeof( uint32_t );
+  size_t count = 0;
+
+  while ( buffer.size() >= PREFIX ) {
+    uint32_t network_order;
+    memcpy( &network_order, buffer.data(), PREFIX );
+    const uint32_t length = be32toh( network_order );
+
+    if ( length > max_length or PREFIX + length > buffer.capacity() ) {
+      throw runtime_error( "frame of " + to_string( length ) + " bytes is too long" );
+    }
+
+    if ( buffer.size() < PREFIX + length ) {
+      break;
+    }
+
+    frame( buffer.data() + PREFIX, length );
+    buffer.consume( PREFIX + length );
+    count++;
+  }
+
+  return count;
+}
@@ -0,0 +1,27 @@
+#ifndef FRAMING_HH
+#define FRAMING_HH
+
+#include <cstddef>
+#include <cstdint>
+
+#include "delegate.hh"
+#include "ring_buffer.hh"
+
+/* Split a stream's input into frames in place: each complete frame in
+   the buffer is handed to `frame` as a pointer into the buffer (valid
+   only during the call), then consumed. An incomplete frame at the end
+   stays for the next read. Each returns how many frames it handed over,
+   and throws if the stream breaks its framing (a frame too big to fit
+   in the buffer could never complete). */
+
+typedef Delegate<void(const char * data, size_t length)> FrameHandler;
+
+/* lines ending in '\n' (handed over without it, nor a '\r' before it) */
+size_t extract_lines( RingBuffer & buffer, const FrameHandler & frame );
+
+/* frames that start with their length as a 32-bit big-endian integer
+   (handed over without the length), of at most max_length bytes */
+size_t extract_length_prefixed( RingBuffer & buffer, const FrameHandler & frame,
+				const uint32_t max_length = UINT32_MAX );
+
+#endif /* FRAMING_HH */
@@ -0,0 +1,79 @@
+#ifndef MPSC_QUEUE_HH
+#define MPSC_QUEUE_HH
+
+#include <atomic>
+
+/* link embedded in anything that goes through an MPSCQueue */
+struct MPSCNode
+{
+  std::atomic<MPSCNode *> mpsc_next;
+
+  MPSCNode() : mpsc_next( nullptr ) {}
+  virtual ~MPSCNode() {}
+
+  MPSCNode( const MPSCNode & other ) = delete;
+  const MPSCNode & operator=( const MPSCNode & other ) = delete;
+};
+
+/* Intrusive multi-producer, single-consumer queue (Vyukov's algorithm).
+   push() is wait-free and may be called from any thread; pop() must only
+   be called from one thread. The queue never allocates. */
+class MPSCQueue
+{
+private:
+  std::atomic<MPSCNode *> head_; /* most recently pushed */
+  MPSCNode * tail_;              /* next to pop (consumer only) */
+  MPSCNode stub_;
+
+public:
+  MPSCQueue() : head_( &stub_ ), tail_( &stub_ ), stub_() {}
+
+  void push( MPSCNode * const node )
+  {
+    node->mpsc_next.store( nullptr, std::memory_order_relaxed );
+    MPSCNode * const previous = head_.exchange( node, std::memory_order_acq_rel );
+    previous->mpsc_next.store( node, std::memory_order_release );
+  }
+
+  /* oldest node, or nullptr if the queue is empty (or a push is
+     half-finished, in which case the pusher will follow up) */
+  MPSCNode * pop( void )
+  {
+    MPSCNode * tail = tail_;
+    MPSCNode * next = tail->mpsc_next.load( std::memory_order_acquire );
+
+    if ( tail == &stub_ ) {
+      if ( not next ) {
+	return nullptr;
+      }
+      tail_ = next;
+      tail = next;
+      next = next->mpsc_next.load( std::memory_order_acquire );
+    }
+
+    if ( next ) {
+      tail_ = next;
+      return tail;
+    }
+
+    if ( tail != head_.load( std::memory_order_acquire ) ) {
+      return nullptr;
+    }
+
+    /* tail is the last node: put the stub behind it so it can be detached */
+    push( &stub_ );
+
+    next = tail->mpsc_next.load( std::memory_order_acquire );
+    if ( next ) {
+      tail_ = next;
+      return tail;
+    }
+
+    return nullptr;
+  }
+
+  MPSCQueue( const MPSCQueue & other ) = delete;
+  const MPSCQueue & operator=( const MPSCQueue & other ) = delete;
+};
+
+#endif /* MPSC_QUEUE_HH */
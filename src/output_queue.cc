@@ -0,0 +1,148 @@
+#include <algorithm>
+#include <climits>
+#include <stdexcept>
+
+#include "output_queue.hh"
+
+using namespace std;
+
+/* writes up to this size are packed into a shared chunk */
+static const size_t PACKED_CHUNK_SIZE = 16384;
+
+/* iovecs per writev (the kernel allows IOV_MAX) */
+static const size_t MAX_IOVECS = min( 64, IOV_MAX );
+
+OutputQueue::OutputQueue( const size_t high_watermark, const size_t low_watermark )
+  : chunks_(),
+    offset_( 0 ),
+    size_( 0 ),
+    high_watermark_( 0 ),
+    low_watermark_( 0 ),
+    paused_( false ),
+    iovecs_( MAX_IOVECS ),
+    spare_()
+{
+  set_watermarks( high_watermark, low_watermark );
+}
+
+void OutputQueue::set_watermarks( const size_t high_watermark, const size_t low_watermark )
+{
+  if ( low_watermark > high_watermark ) {
+    throw runtime_error( "OutputQueue: low watermark above high watermark" );
+  }
+
+  high_watermark_ = high_watermark;
+  low_watermark_ = low_watermark;
+  update_paused();
+}
+
+void OutputQueue::update_paused( void )
+{
+  if ( size_ > high_watermark_ ) {
+    paused_ = true;
+  } else if ( size_ <= low_watermark_ ) {
+    paused_ = false;
+  }
+}
+
+string & OutputQueue::tail( const size_t length )
+{
+  if ( not chunks_.empty() ) {
+    string & last = chunks_.back();
+    if ( last.size() + length <= max( last.capacity(), PACKED_CHUNK_SIZE ) ) {
+      return last;
+    }
+  }
+
+  /* a new chunk, in the storage of an old one if there is one */
+  if ( spare_.empty() ) {
+    chunks_.emplace_back();
+    chunks_.back().reserve( PACKED_CHUNK_SIZE );
+  } else {
+    chunks_.push_back( move( spare_.back() ) );
+    spare_.pop_back();
+  }
+  return chunks_.back();
+}
+
+void OutputQueue::push( const char * const data, const size_t length )
+{
+  if ( length == 0 ) {
+    return;
+  }
+
+  if ( length <= PACKED_CHUNK_SIZE ) {
+    tail( length ).append( data, length );
+  } else {
+    chunks_.emplace_back( data, length );
+  }
+
+  size_ += length;
+  update_paused();
+}
+
+void OutputQueue::push( string && data )
+{
+  if ( data.empty() ) {
+    return;
+  }
+
+  /* small strings are cheaper to pack than to give an iovec of their own */
+  if ( data.size() <= PACKED_CHUNK_SIZE / 4 ) {
+    push( data.data(), data.size() );
+    return;
+  }
+
+  size_ += data.size();
+  chunks_.push_back( move( data ) );
+  update_paused();
+}
+
+IOResult OutputQueue::flush( FileDescriptor & fd )
+{
+  if ( empty() ) {
+    return IOResult( IOResult::Status::Done, 0 );
+  }
+
+  size_t count = 0;
+  for ( auto it = chunks_.begin(); it != chunks_.end() and count < iovecs_.size(); ++it, ++count ) {
+    const size_t skip = count == 0 ? offset_ : 0;
+    iovecs_[ count ].iov_base = const_cast<char *>( it->data() ) + skip;
+    iovecs_[ count ].iov_len = it->size() - skip;
+  }
+
+  const IOResult result = fd.write_some( &iovecs_[ 0 ], count );
+  if ( not result.done() ) {
+    return result;
+  }
+
+  /* retire what was written, keeping the storage of packed chunks */
+  size_t written = result.count;
+  size_ -= written;
+  while ( written > 0 ) {
+    const size_t remaining = chunks_.front().size() - offset_;
+    if ( written < remaining ) {
+      offset_ += written;
+      break;
+    }
+
+    written -= remaining;
+    offset_ = 0;
+    if ( chunks_.front().capacity() <= 4 * PACKED_CHUNK_SIZE and spare_.size() < MAX_IOVECS ) {
+      chunks_.front().clear();
+      spare_.push_back( move( chunks_.front() ) );
+    }
+    chunks_.pop_front();
+  }
+
+  update_paused();
+  return result;
+}
+
+void OutputQueue::clear( void )
+{
+  chunks_.clear();
+  offset_ = 0;
+  size_ = 0;
+  update_paused();
+}
@@ -0,0 +1,61 @@
+#ifndef OUTPUT_QUEUE_HH
+#define OUTPUT_QUEUE_HH
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <sys/uio.h>
+
+#include "file_descriptor.hh"
+
+/* Output waiting for a stream socket. Producers queue chunks (small
+   ones are packed together), and flush() hands as many as it can to
+   one writev, keeping whatever the socket had no room for. The queue
+   has high and low watermarks: once it holds more than the high one it
+   is paused(), and producers should stop (e.g. stop reading requests)
+   until it drains to the low one, so a slow reader can't make it grow
+   without limit. */
+class OutputQueue
+{
+private:
+  std::deque<std::string> chunks_;
+  size_t offset_; /* bytes of the first chunk already written */
+  size_t size_;   /* bytes waiting */
+
+  size_t high_watermark_, low_watermark_;
+  bool paused_;
+
+  /* reused from one flush to the next */
+  std::vector<iovec> iovecs_;
+  std::vector<std::string> spare_; /* written chunks, for their storage */
+
+  /* a chunk to pack small writes into */
+  std::string & tail( const size_t length );
+
+  void update_paused( void );
+
+public:
+  OutputQueue( const size_t high_watermark = 1024 * 1024,
+	       const size_t low_watermark = 256 * 1024 );
+
+  size_t size( void ) const { return size_; }
+  bool empty( void ) const { return size_ == 0; }
+
+  /* over the high watermark, and not yet back down to the low one */
+  bool paused( void ) const { return paused_; }
+  void set_watermarks( const size_t high_watermark, const size_t low_watermark );
+
+  /* queue a copy of some bytes, or a whole string (without copying it) */
+  void push( const char * const data, const size_t length );
+  void push( const std::string & data ) { push( data.data(), data.size() ); }
+  void push( std::string && data );
+
+  /* write as much as `fd` will take now (Done: how many bytes) */
+  IOResult flush( FileDescriptor & fd );
+
+  /* drop everything waiting (e.g. when the connection closes) */
+  void clear( void );
+};
+
+#endif /* OUTPUT_QUEUE_HH */
@@ -1,73 +1,486 @@
 #include <algorithm>
-#include <cassert>
+
+#include <sys/timerfd.h>
+#include <unistd.h>
 
 #include "poller.hh"
 #include "util.hh"
+#include "timestamp.hh"
 
 using namespace std;
 using namespace PollerShortNames;
 
-void Poller::add_action( Poller::Action action )
+/* epoll token for the timerfd (registrations are numbered from 0) */
+static const uint64_t TIMER_TOKEN = -1;
+
+Poller::Poller( const Trigger trigger )
+  : trigger_( trigger ),
+    epoll_( SystemCall( "epoll_create1", epoll_create1( EPOLL_CLOEXEC ) ) ),
+    actions_(),
+    free_actions_(),
+    registrations_(),
+    free_registrations_(),
+    registration_index_(),
+    dirty_(),
+    conditional_(),
+    always_ready_(),
+    interested_count_( 0 ),
+    ready_(),
+    dispatching_( false ),
+    pending_removals_(),
+    dead_registrations_(),
+    timers_( monotonic_ns() ),
+    timerfd_( SystemCall( "timerfd_create",
+			  timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC ) ) ),
+    timerfd_expiry_ns_( -1 )
+{
+  epoll_event event;
+  zero( event );
+  event.events = EPOLLIN;
+  event.data.u64 = TIMER_TOKEN;
+  SystemCall( "epoll_ctl", epoll_ctl( epoll_.fd_num(), EPOLL_CTL_ADD, timerfd_.fd_num(), &event ) );
+}
+
+Poller::~Poller()
+{
+  /* the fds we watch must not call back into us once we are gone */
+  for ( const auto & reg : registrations_ ) {
+    if ( reg.live ) {
+      reg.fd_object->remove_close_hook( reg.close_hook );
+    }
+  }
+}
+
+/* run callback once, delay_ns from now */
+Poller::TimerHandle Poller::add_timer( const uint64_t delay_ns, const TimerWheel::Callback & callback )
+{
+  return timers_.schedule( monotonic_ns() + delay_ns, callback );
+}
+
+/* point the timerfd at the earliest pending timer, if it has moved */
+void Poller::arm_timerfd( void )
+{
+  const uint64_t expiry_ns = timers_.next_expiry_ns();
+  if ( expiry_ns == timerfd_expiry_ns_ ) {
+    return;
+  }
+
+  /* an all-zero expiry disarms the timerfd */
+  itimerspec spec;
+  zero( spec );
+  if ( expiry_ns != uint64_t( -1 ) ) {
+    spec.it_value.tv_sec = expiry_ns / 1000000000;
+    spec.it_value.tv_nsec = expiry_ns % 1000000000;
+  }
+
+  SystemCall( "timerfd_settime",
+	      timerfd_settime( timerfd_.fd_num(), TFD_TIMER_ABSTIME, &spec, nullptr ) );
+  timerfd_expiry_ns_ = expiry_ns;
+}
+
+Poller::ActionHandle Poller::add_action( Poller::Action action )
+{
+  const int fd = action.fd.fd_num();
+  size_t reg_index;
+
+  const auto existing = registration_index_.find( fd );
+  if ( existing != registration_index_.end() ) {
+    reg_index = existing->second;
+  } else {
+    /* first action on this fd: register it with no events for now */
+    const Registration fresh = { fd, &action.fd, 0, {}, 0, false, false, true, true };
+    if ( free_registrations_.empty() ) {
+      reg_index = registrations_.size();
+      registrations_.push_back( fresh );
+    } else {
+      reg_index = free_registrations_.back();
+      free_registrations_.pop_back();
+      registrations_.at( reg_index ) = fresh;
+    }
+    registration_index_[ fd ] = reg_index;
+
+    epoll_event event;
+    zero( event );
+    event.data.u64 = reg_index;
+
+    if ( epoll_ctl( epoll_.fd_num(), EPOLL_CTL_ADD, fd, &event ) < 0 ) {
+      if ( errno != EPERM ) {
+	throw unix_error( "epoll_ctl" );
+      }
+
+      /* epoll refuses regular files, which poll() would always report ready */
+      registrations_.at( reg_index ).epoll_capable = false;
+      always_ready_.push_back( reg_index );
+    }
+
+    /* forget the fd if its object is destroyed before we are */
+    registrations_.at( reg_index ).close_hook
+      = action.fd.add_close_hook( [this, reg_index] () { fd_destroyed( reg_index ); } );
+  }
+
+  Registration & reg = registrations_.at( reg_index );
+  if ( action.when_interested and not reg.conditional ) {
+    reg.conditional = true;
+    conditional_.push_back( reg_index );
+  }
+
+  /* reuse a removed action's slot if there is one */
+  size_t action_index;
+  if ( free_actions_.empty() ) {
+    action_index = actions_.size();
+    actions_.push_back( { nullptr, Direction::In, nullptr, nullptr, false, 0, 0, true } );
+  } else {
+    action_index = free_actions_.back();
+    free_actions_.pop_back();
+  }
+
+  Entry & entry = actions_.at( action_index );
+  entry.fd = &action.fd;
+  entry.direction = action.direction;
+  entry.callback = action.callback;
+  entry.when_interested = action.when_interested;
+  entry.active = action.active;
+  entry.registration = reg_index;
+  entry.removed = false;
+
+  reg.actions.push_back( action_index );
+  mark_dirty( reg_index );
+
+  return (uint64_t( entry.generation ) << 32) | action_index;
+}
+
+/* remove an action (even its own, from inside a callback) */
+bool Poller::remove_action( const ActionHandle handle )
+{
+  const size_t action_index = handle & 0xffffffff;
+  const uint32_t generation = handle >> 32;
+
+  if ( action_index >= actions_.size()
+       or actions_.at( action_index ).generation != generation
+       or actions_.at( action_index ).removed ) {
+    return false;
+  }
+
+  remove_entry( action_index );
+  return true;
+}
+
+/* mark an action removed, unregistering its fd if it was the last one there */
+void Poller::remove_entry( const size_t action_index )
+{
+  Entry & entry = actions_.at( action_index );
+  entry.removed = true;
+  entry.active = false;
+  pending_removals_.push_back( action_index );
+
+  const size_t reg_index = entry.registration;
+  const auto & reg_actions = registrations_.at( reg_index ).actions;
+  if ( all_of( reg_actions.begin(), reg_actions.end(),
+	       [&] ( const size_t i ) { return actions_.at( i ).removed; } ) ) {
+    unregister( reg_index );
+  } else {
+    mark_dirty( reg_index );
+  }
+
+  if ( not dispatching_ ) {
+    collect();
+  }
+}
+
+/* the object behind a registration is being destroyed */
+void Poller::fd_destroyed( const size_t reg_index )
+{
+  for ( const size_t action_index : registrations_.at( reg_index ).actions ) {
+    Entry & entry = actions_.at( action_index );
+    if ( not entry.removed ) {
+      entry.removed = true;
+      entry.active = false;
+      pending_removals_.push_back( action_index );
+    }
+  }
+
+  unregister( reg_index );
+
+  if ( not dispatching_ ) {
+    collect();
+  }
+}
+
+/* stop watching an fd (its actions must already be marked removed) */
+void Poller::unregister( const size_t reg_index )
+{
+  Registration & reg = registrations_.at( reg_index );
+  if ( not reg.live ) {
+    return;
+  }
+
+  reg.live = false;
+  if ( reg.events ) {
+    interested_count_--;
+  }
+  reg.events = 0;
+
+  /* the fd may be on its way to being closed, so errors don't matter here */
+  if ( reg.epoll_capable ) {
+    epoll_ctl( epoll_.fd_num(), EPOLL_CTL_DEL, reg.fd, nullptr );
+  }
+
+  /* the fd number can be reused right away */
+  registration_index_.erase( reg.fd );
+  reg.fd_object->remove_close_hook( reg.close_hook );
+
+  conditional_.erase( remove( conditional_.begin(), conditional_.end(), reg_index ),
+		      conditional_.end() );
+  always_ready_.erase( remove( always_ready_.begin(), always_ready_.end(), reg_index ),
+		       always_ready_.end() );
+
+  dead_registrations_.push_back( reg_index );
+}
+
+/* reclaim the slots of removed actions and unregistered fds */
+void Poller::collect( void )
 {
-  actions_.push_back( action );
-  pollfds_.push_back( { action.fd.fd_num(), 0, 0 } );
+  for ( const size_t action_index : pending_removals_ ) {
+    Entry & entry = actions_.at( action_index );
+
+    auto & reg_actions = registrations_.at( entry.registration ).actions;
+    reg_actions.erase( remove( reg_actions.begin(), reg_actions.end(), action_index ),
+		       reg_actions.end() );
+
+    /* invalidate handles, and let go of whatever the callbacks captured */
+    entry.generation++;
+    entry.fd = nullptr;
+    entry.callback = nullptr;
+    entry.when_interested = nullptr;
+    free_actions_.push_back( action_index );
+  }
+  pending_removals_.clear();
+
+  for ( const size_t reg_index : dead_registrations_ ) {
+    free_registrations_.push_back( reg_index );
+  }
+  dead_registrations_.clear();
 }
 
 unsigned int Poller::Action::service_count( void ) const
 {
-  return direction == Direction::In ? fd.read_count() : fd.write_count();
+  return direction == Direction::Out ? fd.write_count() : fd.read_count();
 }
 
-Poller::Result Poller::poll( const int & timeout_ms )
+unsigned int Poller::Entry::service_count( void ) const
+{
+  return direction == Direction::Out ? fd->write_count() : fd->read_count();
+}
+
+bool Poller::Entry::interested( void ) const
+{
+  if ( not active ) {
+    return false;
+  }
+
+  /* don't poll in on fds that have had EOF */
+  if ( direction == Direction::In and fd->eof() ) {
+    return false;
+  }
+
+  return not when_interested or when_interested();
+}
+
+void Poller::mark_dirty( const size_t reg_index )
+{
+  Registration & reg = registrations_.at( reg_index );
+  if ( not reg.dirty ) {
+    reg.dirty = true;
+    dirty_.push_back( reg_index );
+  }
+}
+
+/* tell epoll what we now care about on one fd, if that has changed */
+void Poller::update_interest( const size_t reg_index )
+{
+  Registration & reg = registrations_.at( reg_index );
+  reg.dirty = false;
+
+  if ( not reg.live ) {
+    return;
+  }
+
+  uint32_t events = 0;
+  for ( const size_t action_index : reg.actions ) {
+    if ( actions_.at( action_index ).interested() ) {
+      events |= actions_.at( action_index ).direction;
+    }
+  }
+
+  if ( events == reg.events ) {
+    return;
+  }
+
+  if ( (events == 0) != (reg.events == 0) ) {
+    if ( events ) {
+      interested_count_++;
+    } else {
+      interested_count_--;
+    }
+  }
+
+  reg.events = events;
+
+  if ( reg.epoll_capable ) {
+    epoll_event event;
+    zero( event );
+    event.events = events | (trigger_ == Trigger::Edge ? uint32_t( EPOLLET ) : 0);
+    event.data.u64 = reg_index;
+    SystemCall( "epoll_ctl", epoll_ctl( epoll_.fd_num(), EPOLL_CTL_MOD, reg.fd, &event ) );
+  }
+}
+
+/* run the callbacks of one ready fd */
+Poller::Result Poller::dispatch( const size_t reg_index, const uint32_t revents )
 {
-  assert( pollfds_.size() == actions_.size() );
+  /* callbacks only run for events we asked for before waiting */
+  const uint32_t wanted = registrations_.at( reg_index ).events & revents;
+
+  /* index afresh each time: a callback may add actions */
+  for ( size_t i = 0; i < registrations_.at( reg_index ).actions.size(); i++ ) {
+    if ( not registrations_.at( reg_index ).live ) {
+      break;
+    }
+
+    const size_t action_index = registrations_.at( reg_index ).actions.at( i );
+
+    if ( actions_.at( action_index ).removed
+	 or not (wanted & actions_.at( action_index ).direction) ) {
+      continue;
+    }
+
+    /* an earlier callback may have hit EOF on this fd, or otherwise
+       changed whether this action wants it (e.g. drained what it was
+       waiting to write) */
+    if ( not actions_.at( action_index ).interested() ) {
+      continue;
+    }
+
+    /* call a copy: if the callback adds actions, actions_ may be reallocated */
+    const Action::CallbackType callback = actions_.at( action_index ).callback;
+    const auto count_before = actions_.at( action_index ).service_count();
+    auto result = callback();
+
+    /* a removed action's fd may already be gone */
+    if ( actions_.at( action_index ).removed ) {
+      continue;
+    }
 
-  /* tell poll whether we care about each fd */
-  for ( unsigned int i = 0; i < actions_.size(); i++ ) {
-    assert( pollfds_.at( i ).fd == actions_.at( i ).fd.fd_num() );
-    pollfds_.at( i ).events = (actions_.at( i ).active and actions_.at( i ).when_interested())
-      ? actions_.at( i ).direction : 0;
+    if ( count_before == actions_.at( action_index ).service_count() ) {
+      throw runtime_error( "Poller: busy wait detected: callback did not read/write fd" );
+    }
 
-    /* don't poll in on fds that have had EOF */
-    if ( actions_.at( i ).direction == Direction::In
-	 and actions_.at( i ).fd.eof() ) {
-      pollfds_.at( i ).events = 0;
+    switch ( result.result ) {
+    case ResultType::Exit:
+      return Result( Result::Type::Exit, result.exit_status );
+    case ResultType::Cancel:
+      remove_entry( action_index );
+      break;
+    case ResultType::Continue:
+      break;
     }
   }
 
-  /* Quit if no member in pollfds_ has a non-zero direction */
-  if ( not accumulate( pollfds_.begin(), pollfds_.end(), false,
-		       [] ( bool acc, pollfd x ) { return acc or x.events; } ) ) {
+  /* the callbacks have probably changed what we are interested in */
+  if ( registrations_.at( reg_index ).live ) {
+    mark_dirty( reg_index );
+  }
+
+  return Result::Type::Success;
+}
+
+Poller::Result Poller::poll( const int & timeout_ms )
+{
+  /* re-evaluate interest only where it may have changed */
+  for ( const size_t reg_index : conditional_ ) {
+    mark_dirty( reg_index );
+  }
+
+  for ( const size_t reg_index : dirty_ ) {
+    update_interest( reg_index );
+  }
+  dirty_.clear();
+
+  /* Quit if no fd has a non-zero direction and no timer is pending */
+  if ( interested_count_ == 0 and timers_.empty() ) {
     return Result::Type::Exit;
   }
 
-  if ( 0 == SystemCall( "poll", ::poll( &pollfds_[ 0 ], pollfds_.size(), timeout_ms ) ) ) {
+  arm_timerfd();
+
+  /* regular files are always ready, so don't block if we want one */
+  const bool file_ready = any_of( always_ready_.begin(), always_ready_.end(),
+				  [&] ( const size_t reg_index ) {
+				    return registrations_.at( reg_index ).events != 0; } );
+
+  ready_.resize( max( size_t( 16 ), registrations_.size() + 1 ) );
+
+  const int ready_count = SystemCall( "epoll_wait",
+				      epoll_wait( epoll_.fd_num(), &ready_[ 0 ], ready_.size(),
+						  file_ready ? 0 : timeout_ms ) );
+
+  if ( ready_count == 0 and not file_ready ) {
     return Result::Type::Timeout;
   }
 
-  for ( unsigned int i = 0; i < pollfds_.size(); i++ ) {
-    if ( pollfds_[ i ].revents & (POLLERR | POLLHUP | POLLNVAL) ) {
-      return Result::Type::Exit;
+  /* while callbacks run, removals are deferred; reclaim
+     the slots however this ends (including by exception) */
+  struct DispatchGuard
+  {
+    Poller & poller;
+    DispatchGuard( Poller & s_poller ) : poller( s_poller ) { poller.dispatching_ = true; }
+    ~DispatchGuard() { poller.dispatching_ = false; poller.collect(); }
+  } guard( *this );
+
+  /* only the ready fds are visited */
+  for ( int i = 0; i < ready_count; i++ ) {
+    if ( ready_[ i ].data.u64 == TIMER_TOKEN ) {
+      uint64_t expirations;
+      if ( ::read( timerfd_.fd_num(), &expirations, sizeof( expirations ) ) < 0 and errno != EAGAIN ) {
+	throw unix_error( "read (timerfd)" );
+      }
+
+      /* the timerfd is now disarmed; arm_timerfd() must not skip re-arming it */
+      timerfd_expiry_ns_ = -1;
+      timers_.advance( monotonic_ns() );
+      continue;
     }
 
-    if ( pollfds_[ i ].revents & pollfds_[ i ].events ) {
-      /* we only want to call callback if revents includes
-	 the event we asked for */
-      const auto count_before = actions_.at( i ).service_count();
-      auto result = actions_.at( i ).callback();
+    /* an earlier callback may have removed this fd */
+    if ( not registrations_.at( ready_[ i ].data.u64 ).live ) {
+      continue;
+    }
 
-      if ( count_before == actions_.at( i ).service_count() ) {
-	throw runtime_error( "Poller: busy wait detected: callback did not read/write fd" );
+    /* an error (or hangup) is only expected if an action is there to handle it */
+    uint32_t revents = ready_[ i ].events;
+    if ( revents & (EPOLLERR | EPOLLHUP) ) {
+      if ( not (registrations_.at( ready_[ i ].data.u64 ).events & EPOLLERR) ) {
+	return Result::Type::Exit;
       }
+      revents |= EPOLLERR;
+    }
 
-      switch ( result.result ) {
-      case ResultType::Exit:
-	return Result( Result::Type::Exit, result.exit_status );
-      case ResultType::Cancel:
-	actions_.at( i ).active = false;
-      case ResultType::Continue:
-	break;
-      }
+    const auto result = dispatch( ready_[ i ].data.u64, revents );
+    if ( result.result == Result::Type::Exit ) {
+      return result;
+    }
+  }
+
+  /* (copied, since callbacks may unregister files) */
+  const vector< size_t > files = always_ready_;
+  for ( const size_t reg_index : files ) {
+    if ( not registrations_.at( reg_index ).live ) {
+      continue;
+    }
+
+    const auto result = dispatch( reg_index, registrations_.at( reg_index ).events );
+    if ( result.result == Result::Type::Exit ) {
+      return result;
     }
   }
 
@@ -1,12 +1,15 @@
 #ifndef POLLER_HH
 #define POLLER_HH
 
-#include <functional>
+#include <unordered_map>
 #include <vector>
 
 #include <poll.h>
+#include <sys/epoll.h>
 
+#include "delegate.hh"
 #include "file_descriptor.hh"
+#include "timer_wheel.hh"
 
 class Poller
 {
@@ -21,27 +24,119 @@ public:
 	: result( s_result ), exit_status( s_status ) {}
     };
 
-    typedef std::function<Result(void)> CallbackType;
+    /* stored inline, so adding or copying an Action never allocates */
+    typedef Delegate<Result(void)> CallbackType;
+    typedef Delegate<bool(void)> InterestType;
 
     FileDescriptor & fd;
-    enum PollDirection : short { In = POLLIN, Out = POLLOUT } direction;
+    /* Error: the socket's error queue has something (e.g. TX timestamps),
+       or the fd has hung up; without an Error action, either makes poll() exit */
+    enum PollDirection : short { In = POLLIN, Out = POLLOUT, Error = POLLERR } direction;
     CallbackType callback;
-    std::function<bool(void)> when_interested;
+    InterestType when_interested; /* empty means "always" */
     bool active;
 
     Action( FileDescriptor & s_fd,
 	    const PollDirection & s_direction,
 	    const CallbackType & s_callback,
-	    const std::function<bool(void)> & s_when_interested = [] () { return true; } )
+	    const InterestType & s_when_interested = InterestType() )
       : fd( s_fd ), direction( s_direction ), callback( s_callback ),
 	when_interested( s_when_interested ), active( true ) {}
 
     unsigned int service_count( void ) const;
   };
 
+  /* identifies one added action; stale handles are harmless */
+  typedef uint64_t ActionHandle;
+
+  /* level-triggered epoll reports an fd every time it is ready;
+     edge-triggered only when it becomes ready, so callbacks must drain
+     it (on a nonblocking fd, e.g. read_some() until would_block()) */
+  enum class Trigger { Level, Edge };
+
 private:
-  std::vector< Action > actions_;
-  std::vector< pollfd > pollfds_;
+  /* an added action, in a slot that is reused once the action is removed
+     (the fd is held by pointer so that slots can be reassigned) */
+  struct Entry
+  {
+    FileDescriptor * fd;
+    Action::PollDirection direction;
+    Action::CallbackType callback;
+    Action::InterestType when_interested;
+    bool active;
+
+    uint32_t generation;
+    size_t registration;
+    bool removed;
+
+    unsigned int service_count( void ) const;
+
+    /* does this action want its callback run when the fd is ready? */
+    bool interested( void ) const;
+  };
+
+  /* everything registered for one fd (epoll allows one registration per fd) */
+  struct Registration
+  {
+    int fd;
+    FileDescriptor * fd_object;
+    uint64_t close_hook;   /* lets us forget the fd when its object is destroyed */
+    std::vector<size_t> actions;
+    uint32_t events;       /* what epoll is currently asked to report */
+    bool conditional;      /* does any action have a when_interested rule? */
+    bool dirty;            /* must events be recomputed before the next wait? */
+    bool epoll_capable;    /* false for regular files, which are always ready */
+    bool live;             /* false once unregistered (the slot awaits reuse) */
+  };
+
+  Trigger trigger_;
+  FileDescriptor epoll_;
+
+  std::vector< Entry > actions_;
+  std::vector< size_t > free_actions_;
+  std::vector< Registration > registrations_;
+  std::vector< size_t > free_registrations_;
+  std::unordered_map< int, size_t > registration_index_; /* fd -> registration */
+
+  /* registrations whose interest may have changed since the last wait */
+  std::vector< size_t > dirty_;
+  std::vector< size_t > conditional_;
+
+  /* registrations that epoll refuses (regular files) */
+  std::vector< size_t > always_ready_;
+
+  /* how many registrations currently want any events */
+  size_t interested_count_;
+
+  std::vector< epoll_event > ready_;
+
+  /* while callbacks run, removals are only marked; the
+     slots are reclaimed once dispatching is finished */
+  bool dispatching_;
+  std::vector< size_t > pending_removals_;
+  std::vector< size_t > dead_registrations_;
+
+  /* timers, driven by a timerfd armed for the earliest one */
+  TimerWheel timers_;
+  FileDescriptor timerfd_;
+  uint64_t timerfd_expiry_ns_;
+
+  void arm_timerfd( void );
+
+  void mark_dirty( const size_t reg_index );
+  void update_interest( const size_t reg_index );
+
+  /* mark an action removed, unregistering its fd if it was the last one there */
+  void remove_entry( const size_t action_index );
+
+  /* stop watching an fd (its actions must already be marked removed) */
+  void unregister( const size_t reg_index );
+
+  /* the object behind a registration is being destroyed */
+  void fd_destroyed( const size_t reg_index );
+
+  /* reclaim the slots of removed actions and unregistered fds */
+  void collect( void );
 
 public:
   struct Result
@@ -52,9 +147,29 @@ public:
       : result( s_result ), exit_status( s_status ) {}
   };
 
-  Poller() : actions_(), pollfds_() {}
-  void add_action( Action action );
+private:
+  /* run the callbacks of one ready fd */
+  Result dispatch( const size_t reg_index, const uint32_t revents );
+
+public:
+  Poller( const Trigger trigger = Trigger::Level );
+  ~Poller();
+
+  ActionHandle add_action( Action action );
+
+  /* remove an action (even its own, from inside a callback);
+     false if it was already removed */
+  bool remove_action( const ActionHandle handle );
+
   Result poll( const int & timeout_ms );
+
+  typedef TimerWheel::Handle TimerHandle;
+
+  /* run callback once, delay_ns from now (from inside poll()) */
+  TimerHandle add_timer( const uint64_t delay_ns, const TimerWheel::Callback & callback );
+
+  /* stop a timer; false if it already fired or was cancelled */
+  bool cancel_timer( const TimerHandle handle ) { return timers_.cancel( handle ); }
 };
 
 namespace PollerShortNames {
@@ -0,0 +1,70 @@
+#include <stdexcept>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "file_descriptor.hh"
+#include "ring_buffer.hh"
+#include "util.hh"
+
+using namespace std;
+
+RingBuffer::RingBuffer( const size_t capacity )
+  : capacity_( 0 ),
+    base_( nullptr ),
+    start_( 0 ),
+    end_( 0 )
+{
+  const size_t page = SystemCall( "sysconf", sysconf( _SC_PAGESIZE ) );
+  capacity_ = max( (capacity + page - 1) / page, size_t( 1 ) ) * page;
+
+  /* reserve room for both views, then map the same memory into each half */
+  FileDescriptor memory( SystemCall( "memfd_create", memfd_create( "RingBuffer", MFD_CLOEXEC ) ) );
+  SystemCall( "ftruncate", ftruncate( memory.fd_num(), capacity_ ) );
+
+  void * const reserved = mmap( nullptr, 2 * capacity_, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+  if ( reserved == MAP_FAILED ) {
+    throw unix_error( "mmap" );
+  }
+  base_ = static_cast<char *>( reserved );
+
+  for ( const size_t offset : { size_t( 0 ), capacity_ } ) {
+    if ( mmap( base_ + offset, capacity_, PROT_READ | PROT_WRITE,
+	       MAP_SHARED | MAP_FIXED, memory.fd_num(), 0 ) == MAP_FAILED ) {
+      const unix_error error( "mmap" );
+      munmap( base_, 2 * capacity_ );
+      throw error;
+    }
+  }
+  /* (the mappings keep the memory alive once the fd closes) */
+}
+
+RingBuffer::~RingBuffer()
+{
+  try {
+    SystemCall( "munmap", munmap( base_, 2 * capacity_ ) );
+  } catch ( const exception & e ) { /* don't throw from destructor */
+    print_exception( e );
+  }
+}
+
+void RingBuffer::consume( const size_t count )
+{
+  if ( count > size() ) {
+    throw runtime_error( "RingBuffer::consume: more than it holds" );
+  }
+  start_ += count;
+
+  /* an empty ring starts over at the front (which keeps the positions small) */
+  if ( start_ == end_ ) {
+    start_ = end_ = 0;
+  }
+}
+
+void RingBuffer::produce( const size_t count )
+{
+  if ( count > room() ) {
+    throw runtime_error( "RingBuffer::produce: more than fits" );
+  }
+  end_ += count;
+}
@@ -0,0 +1,50 @@
+#ifndef RING_BUFFER_HH
+#define RING_BUFFER_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/* A byte ring for a stream's input. FileDescriptor::read_into() fills it
+   in place, and a parser looks at what has arrived and consumes it, so
+   nothing is copied into intermediate strings. The storage is mapped
+   twice, back to back, so both the data and the free space are always
+   contiguous, wherever they wrap: a frame that straddles the end of the
+   ring reads as one piece. */
+class RingBuffer
+{
+private:
+  size_t capacity_;
+  char * base_;    /* capacity_ bytes, then the same bytes again */
+  uint64_t start_; /* bytes consumed so far */
+  uint64_t end_;   /* bytes produced so far */
+
+public:
+  /* room for at least `capacity` bytes (rounded up to whole pages) */
+  explicit RingBuffer( const size_t capacity = 65536 );
+  ~RingBuffer();
+
+  size_t capacity( void ) const { return capacity_; }
+  size_t size( void ) const { return end_ - start_; }
+  bool empty( void ) const { return start_ == end_; }
+
+  /* the unconsumed bytes, contiguous (valid until they are consumed) */
+  const char * data( void ) const { return base_ + start_ % capacity_; }
+  std::string str( void ) const { return std::string( data(), size() ); }
+
+  /* drop bytes from the front, once parsed */
+  void consume( const size_t count );
+
+  /* where new bytes go: room() of them, contiguous */
+  char * space( void ) { return base_ + end_ % capacity_; }
+  size_t room( void ) const { return capacity_ - size(); }
+
+  /* count bytes were written at space() */
+  void produce( const size_t count );
+
+  /* forbid copying */
+  RingBuffer( const RingBuffer & other ) = delete;
+  const RingBuffer & operator=( const RingBuffer & other ) = delete;
+};
+
+#endif /* RING_BUFFER_HH */
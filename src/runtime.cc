@@ -0,0 +1,189 @@
+#include <iostream>
+#include <stdexcept>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "runtime.hh"
+#include "util.hh"
+
+using namespace std;
+using namespace PollerShortNames;
+
+/* pin the calling thread to one CPU */
+void pin_this_thread( const int cpu )
+{
+  cpu_set_t cpus;
+  CPU_ZERO( &cpus );
+  CPU_SET( cpu, &cpus );
+
+  /* pthread functions return the error instead of setting errno */
+  const int error = pthread_setaffinity_np( pthread_self(), sizeof( cpus ), &cpus );
+  if ( error ) {
+    throw unix_error( "pthread_setaffinity_np", error );
+  }
+}
+
+Runtime::Worker::Worker( const size_t index, const int cpu )
+  : index_( index ),
+    cpu_( cpu ),
+    wakeup_( SystemCall( "eventfd", eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) ),
+    wakeup_pending_( false ),
+    tasks_(),
+    poller_(),
+    owned_(),
+    stopping_( false ),
+    thread_( [this] () { loop(); } )
+{}
+
+Runtime::Worker::~Worker()
+{
+  if ( thread_.joinable() ) {
+    try {
+      stop();
+    } catch ( const exception & e ) { /* don't throw from destructor */
+      print_exception( e );
+    }
+    join();
+  }
+
+  /* tasks posted too late to run */
+  while ( MPSCNode * const node = tasks_.pop() ) {
+    delete static_cast<Task *>( node );
+  }
+}
+
+void Runtime::Worker::enqueue( Task * const task )
+{
+  tasks_.push( task );
+
+  /* only the first post since the worker last looked needs to wake it */
+  if ( not wakeup_pending_.exchange( true ) ) {
+    const uint64_t one = 1;
+    SystemCall( "write", ::write( wakeup_.fd_num(), &one, sizeof( one ) ) );
+  }
+}
+
+void Runtime::Worker::run_tasks( void )
+{
+  /* clear the flag first, so a post that races with the drain wakes us
+     again (acquire: this drain sees every push made before the flag) */
+  wakeup_pending_.exchange( false, memory_order_acq_rel );
+
+  while ( MPSCNode * const node = tasks_.pop() ) {
+    unique_ptr<Task> task( static_cast<Task *>( node ) );
+    task->run( *this );
+  }
+}
+
+void Runtime::Worker::close( FileDescriptor & fd )
+{
+  /* the fd's close hook takes its actions out of the Poller */
+  if ( not owned_.erase( &fd ) ) {
+    throw runtime_error( "Runtime::Worker::close: fd not owned by this worker" );
+  }
+}
+
+void Runtime::Worker::stop( void )
+{
+  post( [] ( Worker & worker ) { worker.stopping_ = true; } );
+}
+
+void Runtime::Worker::join( void )
+{
+  if ( thread_.joinable() ) {
+    thread_.join();
+  }
+}
+
+void Runtime::Worker::loop( void )
+{
+  try {
+    if ( cpu_ >= 0 ) {
+      pin_this_thread( cpu_ );
+    }
+  } catch ( const exception & e ) { /* run unpinned */
+    print_exception( e );
+  }
+
+  try {
+    poller_.add_action( Action( wakeup_, Direction::In,
+				[this] () {
+				  /* reset the eventfd's counter (nothing
+				     to do if a spurious wakeup found it 0) */
+				  uint64_t count;
+				  const IOResult result = wakeup_.read_some( reinterpret_cast<char *>( &count ),
+									     sizeof( count ) );
+				  if ( result.failed() ) {
+				    result.check( "read eventfd" );
+				  }
+				  run_tasks();
+				  return ResultType::Continue;
+				} ) );
+
+    while ( not stopping_ ) {
+      if ( poller_.poll( -1 ).result == PollResult::Exit ) {
+	break;
+      }
+    }
+  } catch ( const exception & e ) {
+    print_exception( e );
+  }
+
+  /* sockets go before the thread does (the Poller still outlives them) */
+  owned_.clear();
+}
+
+Runtime::Runtime( const size_t worker_count, const bool pin_threads )
+  : workers_(),
+    next_worker_( 0 )
+{
+  /* spread the workers over the CPUs this process may use */
+  vector<int> cpus;
+  cpu_set_t allowed;
+  CPU_ZERO( &allowed );
+  SystemCall( "sched_getaffinity", sched_getaffinity( 0, sizeof( allowed ), &allowed ) );
+  for ( int cpu = 0; cpu < CPU_SETSIZE; cpu++ ) {
+    if ( CPU_ISSET( cpu, &allowed ) ) {
+      cpus.push_back( cpu );
+    }
+  }
+
+  const size_t count = worker_count ? worker_count : 1;
+  for ( size_t i = 0; i < count; i++ ) {
+    const int cpu = (pin_threads and not cpus.empty()) ? cpus.at( i % cpus.size() ) : -1;
+    workers_.emplace_back( new Worker( i, cpu ) );
+  }
+}
+
+Runtime::~Runtime()
+{
+  try {
+    stop();
+  } catch ( const exception & e ) { /* don't throw from destructor */
+    print_exception( e );
+  }
+}
+
+Runtime::Worker & Runtime::next_worker( void )
+{
+  return *workers_.at( next_worker_.fetch_add( 1, memory_order_relaxed ) % workers_.size() );
+}
+
+void Runtime::stop( void )
+{
+  for ( auto & worker : workers_ ) {
+    worker->stop();
+  }
+
+  wait();
+}
+
+void Runtime::wait( void )
+{
+  for ( auto & worker : workers_ ) {
+    worker->join();
+  }
+}
@@ -0,0 +1,166 @@
+#ifndef RUNTIME_HH
+#define RUNTIME_HH
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "file_descriptor.hh"
+#include "mpsc_queue.hh"
+#include "poller.hh"
+
+/* Runtime: one event loop (Poller) per worker thread, each pinned to its
+   own core. Threads talk only by posting tasks to each other's lock-free
+   queues, so nothing on the hot path takes a shared lock. */
+class Runtime
+{
+public:
+  class Worker;
+
+  /* a unit of work posted to a Worker from any thread */
+  class Task : public MPSCNode
+  {
+  public:
+    Task() : MPSCNode() {}
+    virtual ~Task() {}
+    virtual void run( Worker & worker ) = 0;
+  };
+
+  class Worker
+  {
+  private:
+    template <typename F>
+    class FunctionTask : public Task
+    {
+    private:
+      F function_;
+    public:
+      FunctionTask( F && function ) : function_( std::move( function ) ) {}
+      void run( Worker & worker ) override { function_( worker ); }
+    };
+
+    template <typename S, typename F>
+    class HandOffTask : public Task
+    {
+    private:
+      S socket_;
+      F setup_;
+    public:
+      HandOffTask( S && socket, F && setup ) : socket_( std::move( socket ) ), setup_( std::move( setup ) ) {}
+      void run( Worker & worker ) override { setup_( worker, worker.adopt( std::move( socket_ ) ) ); }
+    };
+
+    size_t index_;
+    int cpu_;
+
+    FileDescriptor wakeup_;          /* eventfd that interrupts the Poller */
+    std::atomic<bool> wakeup_pending_;
+    MPSCQueue tasks_;
+
+    Poller poller_;
+    std::unordered_map<FileDescriptor *, std::unique_ptr<FileDescriptor>> owned_;
+
+    bool stopping_;
+    std::thread thread_;
+
+    /* queue a task and make sure the worker will notice it */
+    void enqueue( Task * const task );
+
+    /* run everything queued so far (worker thread only) */
+    void run_tasks( void );
+
+    /* the worker thread's main loop */
+    void loop( void );
+
+  public:
+    /* start a worker thread, pinned to `cpu` unless it is negative */
+    Worker( const size_t index, const int cpu );
+
+    /* stops the thread if need be, and drops any tasks that never ran */
+    ~Worker();
+
+    size_t index( void ) const { return index_; }
+    int cpu( void ) const { return cpu_; }
+
+    /* (worker thread only) the worker's event loop */
+    Poller & poller( void ) { return poller_; }
+
+    /* run `task( worker )` on this worker's thread; callable from any thread */
+    template <typename F>
+    void post( F && task )
+    {
+      typedef typename std::decay<F>::type Function;
+      Function function( std::forward<F>( task ) );
+      enqueue( new FunctionTask<Function>( std::move( function ) ) );
+    }
+
+    /* move a socket (an accepted TCPSocket, or a UDPSocket shard) to this
+       worker, then run `setup( worker, socket )` on its thread. The worker
+       owns the socket from then on, until close(). */
+    template <typename S, typename F>
+    void hand_off( S && socket, F && setup )
+    {
+      static_assert( not std::is_lvalue_reference<S>::value, "hand_off: socket must be moved in" );
+      typedef typename std::decay<F>::type Setup;
+      Setup function( std::forward<F>( setup ) );
+      enqueue( new HandOffTask<S, Setup>( std::move( socket ), std::move( function ) ) );
+    }
+
+    /* (worker thread only) take ownership of a socket */
+    template <typename S>
+    S & adopt( S && socket )
+    {
+      static_assert( not std::is_lvalue_reference<S>::value, "adopt: socket must be moved in" );
+      S * const owned = new S( std::move( socket ) );
+      owned_[ owned ].reset( owned );
+      return *owned;
+    }
+
+    /* (worker thread only) close and destroy an owned socket; its Poller
+       actions go with it, so this is safe from the socket's own callback */
+    void close( FileDescriptor & fd );
+
+    /* ask the worker to finish (callable from any thread), and wait for it */
+    void stop( void );
+    void join( void );
+
+    Worker( const Worker & other ) = delete;
+    const Worker & operator=( const Worker & other ) = delete;
+  };
+
+private:
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::atomic<size_t> next_worker_;
+
+public:
+  /* one worker per core by default, each pinned to its own core */
+  Runtime( const size_t worker_count = std::thread::hardware_concurrency(),
+	   const bool pin_threads = true );
+
+  /* stops and joins every worker */
+  ~Runtime();
+
+  size_t size( void ) const { return workers_.size(); }
+  Worker & worker( const size_t i ) { return *workers_.at( i ); }
+
+  /* workers in turn, for spreading out connections */
+  Worker & next_worker( void );
+
+  /* stop every worker, and wait until they have all finished */
+  void stop( void );
+
+  /* wait until every worker has stopped (e.g. from the main thread) */
+  void wait( void );
+
+  Runtime( const Runtime & other ) = delete;
+  const Runtime & operator=( const Runtime & other ) = delete;
+};
+
+/* pin the calling thread to one CPU */
+void pin_this_thread( const int cpu );
+
+#endif /* RUNTIME_HH */
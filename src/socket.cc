@@ -1,4 +1,9 @@
+#include <sys/sendfile.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
 
 #include "socket.hh"
 #include "util.hh"
@@ -75,40 +80,31 @@ void Socket::connect( const Address & address )
 				    address.size() ) );
 }
 
-/* receive datagram and where it came from */
-UDPSocket::received_datagram UDPSocket::recv( void )
+/* older headers lack the UDP segmentation-offload and incoming-CPU options */
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#ifndef SO_INCOMING_CPU
+#define SO_INCOMING_CPU 49
+#endif
+
+/* room for the ancillary data we ask for: SO_TIMESTAMPNS, SO_TIMESTAMPING and UDP_GRO */
+static const size_t CONTROL_SIZE = CMSG_SPACE( sizeof( timespec ) )
+  + CMSG_SPACE( sizeof( scm_timestamping ) ) + CMSG_SPACE( sizeof( int ) );
+
+/* room for one TX timestamp from the error queue: the timestamp, and the
+   extended error that says which send it belongs to */
+static const size_t TX_CONTROL_SIZE = CMSG_SPACE( sizeof( scm_timestamping ) )
+  + CMSG_SPACE( sizeof( sock_extended_err ) + sizeof( sockaddr_in6 ) );
+
+/* make sure we got the whole datagram, then find its kernel timestamp
+   (as nanoseconds of monotonic time) and GRO segment size (if there are any) */
+static uint64_t check_flags_and_parse_control( msghdr & header, size_t & segment_size,
+					       const int64_t realtime_offset )
 {
-  static const ssize_t RECEIVE_MTU = 65536;
-
-  /* receive source address, timestamp and payload */
-  Address::raw datagram_source_address;
-  msghdr header; zero( header );
-  iovec msg_iovec; zero( msg_iovec );
-
-  char msg_payload[ RECEIVE_MTU ];
-  char msg_control[ RECEIVE_MTU ];
-
-  /* prepare to get the source address */
-  header.msg_name = &datagram_source_address;
-  header.msg_namelen = sizeof( datagram_source_address );
-
-  /* prepare to get the payload */
-  msg_iovec.iov_base = msg_payload;
-  msg_iovec.iov_len = sizeof( msg_payload );
-  header.msg_iov = &msg_iovec;
-  header.msg_iovlen = 1;
-
-  /* prepare to get the timestamp */
-  header.msg_control = msg_control;
-  header.msg_controllen = sizeof( msg_control );
-
-  /* call recvmsg */
-  ssize_t recv_len = SystemCall( "recvmsg",
-				 recvmsg( fd_num(), &header, 0 ) );
-
-  register_read();
-
-  /* make sure we got the whole datagram */
   if ( header.msg_flags & MSG_TRUNC ) {
     throw runtime_error( "recvfrom (oversized datagram)" );
   } else if ( header.msg_flags ) {
@@ -117,21 +113,192 @@ UDPSocket::received_datagram UDPSocket::recv( void )
 
   uint64_t timestamp = -1;
 
-  /* find the timestamp header (if there is one) */
+  /* find the timestamp and segment-size headers (if there are any) */
   cmsghdr *ts_hdr = CMSG_FIRSTHDR( &header );
   while ( ts_hdr ) {
     if ( ts_hdr->cmsg_level == SOL_SOCKET
 	 and ts_hdr->cmsg_type == SO_TIMESTAMPNS ) {
       const timespec * const kernel_time = reinterpret_cast<timespec *>( CMSG_DATA( ts_hdr ) );
-      timestamp = timestamp_ms( *kernel_time );
+      timestamp = timestamp_ns( *kernel_time, realtime_offset );
+    } else if ( ts_hdr->cmsg_level == SOL_SOCKET
+		and ts_hdr->cmsg_type == SCM_TIMESTAMPING ) {
+      /* the software timestamp comes first (hardware ones are not asked for) */
+      scm_timestamping kernel_times;
+      memcpy( &kernel_times, CMSG_DATA( ts_hdr ), sizeof( kernel_times ) );
+      if ( kernel_times.ts[ 0 ].tv_sec or kernel_times.ts[ 0 ].tv_nsec ) {
+	timestamp = timestamp_ns( kernel_times.ts[ 0 ], realtime_offset );
+      }
+    } else if ( ts_hdr->cmsg_level == SOL_UDP
+		and ts_hdr->cmsg_type == UDP_GRO ) {
+      int gso_size;
+      memcpy( &gso_size, CMSG_DATA( ts_hdr ), sizeof( gso_size ) );
+      segment_size = gso_size;
     }
     ts_hdr = CMSG_NXTHDR( &header, ts_hdr );
   }
 
-  received_datagram ret = { Address( datagram_source_address,
-				     header.msg_namelen ),
-			    timestamp,
-			    string( msg_payload, recv_len ) };
+  return timestamp;
+}
+
+/* room for `capacity` datagrams of up to `mtu` bytes each */
+UDPSocket::ReceiveBuffers::ReceiveBuffers( const size_t capacity, const size_t mtu )
+  : mtu_( mtu ),
+    payloads_(),
+    control_(),
+    addresses_(),
+    iovecs_(),
+    headers_(),
+    timestamps_(),
+    segment_sizes_(),
+    count_( 0 )
+{
+  resize( capacity );
+}
+
+/* grow (or shrink) to room for `capacity` datagrams */
+void UDPSocket::ReceiveBuffers::resize( const size_t capacity )
+{
+  payloads_.resize( capacity * mtu_ );
+  control_.resize( capacity * CONTROL_SIZE );
+  addresses_.resize( capacity );
+  iovecs_.resize( capacity );
+  headers_.resize( capacity );
+  timestamps_.resize( capacity );
+  segment_sizes_.resize( capacity );
+  count_ = 0;
+}
+
+/* point the message headers at this object's storage */
+void UDPSocket::ReceiveBuffers::prepare( void )
+{
+  for ( size_t i = 0; i < capacity(); i++ ) {
+    msghdr & header = headers_[ i ].msg_hdr;
+    zero( header );
+
+    /* prepare to get the source address */
+    header.msg_name = &addresses_[ i ];
+    header.msg_namelen = sizeof( Address::raw );
+
+    /* prepare to get the payload */
+    iovecs_[ i ].iov_base = &payloads_[ i * mtu_ ];
+    iovecs_[ i ].iov_len = mtu_;
+    header.msg_iov = &iovecs_[ i ];
+    header.msg_iovlen = 1;
+
+    /* prepare to get the timestamp */
+    header.msg_control = &control_[ i * CONTROL_SIZE ];
+    header.msg_controllen = CONTROL_SIZE;
+  }
+
+  count_ = 0;
+}
+
+/* the i'th datagram of the last receive */
+Address UDPSocket::ReceiveBuffers::source_address( const size_t i ) const
+{
+  return Address( addresses_.at( i ), headers_.at( i ).msg_hdr.msg_namelen );
+}
+
+/* receive between 1 and max_datagrams datagrams into buffers */
+IOResult UDPSocket::receive( ReceiveBuffers & buffers, const size_t max_datagrams, const int flags )
+{
+  if ( max_datagrams == 0 or max_datagrams > buffers.capacity() ) {
+    throw runtime_error( "UDPSocket: receive buffers too small" );
+  }
+
+  buffers.prepare();
+
+  /* wait for the first datagram, then take whatever else is already queued */
+  int count;
+  do {
+    count = recvmmsg( fd_num(), &buffers.headers_[ 0 ], max_datagrams,
+		      MSG_WAITFORONE | flags, nullptr );
+  } while ( count < 0 and errno == EINTR );
+
+  if ( count < 0 ) {
+    register_read(); /* (it was looked at) */
+    return IOResult::from_return( count );
+  }
+
+  /* the kernel stamps datagrams with wall-clock time; sample how far
+     that is from monotonic time once for the whole batch */
+  const int64_t realtime_offset = realtime_offset_ns();
+
+  for ( int i = 0; i < count; i++ ) {
+    register_read();
+
+    /* a datagram that wasn't coalesced is one segment */
+    buffers.segment_sizes_[ i ] = buffers.headers_[ i ].msg_len;
+    buffers.timestamps_[ i ] = check_flags_and_parse_control( buffers.headers_[ i ].msg_hdr,
+							       buffers.segment_sizes_[ i ],
+							       realtime_offset );
+  }
+
+  buffers.count_ = count;
+  return IOResult( IOResult::Status::Done, count );
+}
+
+/* receive into caller's buffers, without copying or allocating */
+size_t UDPSocket::recv_into( ReceiveBuffers & buffers )
+{
+  return receive( buffers, buffers.capacity(), 0 ).check( "recvmmsg" ).count;
+}
+
+/* the same, without waiting or throwing */
+IOResult UDPSocket::try_recv_into( ReceiveBuffers & buffers )
+{
+  return receive( buffers, buffers.capacity(), MSG_DONTWAIT );
+}
+
+/* receive datagram and where it came from */
+UDPSocket::received_datagram UDPSocket::recv( void )
+{
+  if ( recv_buffers_.capacity() == 0 ) {
+    recv_buffers_.resize( 1 );
+  }
+
+  receive( recv_buffers_, 1, 0 ).check( "recvmmsg" );
+
+  received_datagram ret = { recv_buffers_.source_address( 0 ),
+			    recv_buffers_.timestamp( 0 ),
+			    string( recv_buffers_.payload( 0 ), recv_buffers_.payload_length( 0 ) ) };
+
+  return ret;
+}
+
+/* prepare the scratch space for a batch of n outgoing messages */
+void UDPSocket::prepare_send_batch( const size_t n )
+{
+  if ( send_headers_.size() < n ) {
+    send_iovecs_.resize( n );
+    send_headers_.resize( n );
+  }
+
+  for ( size_t i = 0; i < n; i++ ) {
+    zero( send_headers_[ i ] );
+    zero( send_iovecs_[ i ] );
+    send_headers_[ i ].msg_hdr.msg_iov = &send_iovecs_[ i ];
+    send_headers_[ i ].msg_hdr.msg_iovlen = 1;
+  }
+}
+
+/* receive between 1 and max_datagrams datagrams with one syscall */
+vector<UDPSocket::received_datagram> UDPSocket::recv_batch( const size_t max_datagrams )
+{
+  if ( recv_buffers_.capacity() < max_datagrams ) {
+    recv_buffers_.resize( max_datagrams );
+  }
+
+  const size_t count = receive( recv_buffers_, max_datagrams, 0 ).check( "recvmmsg" ).count;
+
+  vector<received_datagram> ret;
+  ret.reserve( count );
+
+  for ( size_t i = 0; i < count; i++ ) {
+    ret.push_back( { recv_buffers_.source_address( i ),
+		     recv_buffers_.timestamp( i ),
+		     string( recv_buffers_.payload( i ), recv_buffers_.payload_length( i ) ) } );
+  }
 
   return ret;
 }
@@ -170,6 +337,147 @@ void UDPSocket::send( const string & payload )
   }
 }
 
+/* send one datagram without waiting or throwing */
+IOResult UDPSocket::try_sendto( const Address & destination, const string & payload )
+{
+  register_write();
+  return IOResult::from_return( ::sendto( fd_num(), payload.data(), payload.size(), MSG_DONTWAIT,
+					  &destination.to_sockaddr(), destination.size() ) );
+}
+
+IOResult UDPSocket::try_send( const string & payload )
+{
+  register_write();
+  return IOResult::from_return( ::send( fd_num(), payload.data(), payload.size(), MSG_DONTWAIT ) );
+}
+
+/* hand the first n prepared messages to sendmmsg, retrying until all are sent */
+void UDPSocket::send_prepared_batch( const size_t n )
+{
+  size_t sent = 0;
+
+  while ( sent < n ) {
+    const int count = SystemCall( "sendmmsg",
+				  sendmmsg( fd_num(), &send_headers_[ sent ], n - sent, 0 ) );
+
+    for ( int i = 0; i < count; i++ ) {
+      register_write();
+
+      const mmsghdr & header = send_headers_[ sent + i ];
+      if ( header.msg_len != header.msg_hdr.msg_iov->iov_len ) {
+	throw runtime_error( "datagram payload too big for sendmmsg()" );
+      }
+    }
+
+    sent += count;
+  }
+}
+
+/* send several datagrams, each to its own address, with as few syscalls as possible */
+void UDPSocket::sendto_batch( const vector<pair<Address, string>> & datagrams )
+{
+  sendto_batch( datagrams, datagrams.size() );
+}
+
+/* send the first `count` datagrams, so that the caller can reuse a vector
+   (and the strings in it) that only ever grows */
+void UDPSocket::sendto_batch( const vector<pair<Address, string>> & datagrams, const size_t count )
+{
+  if ( count > datagrams.size() ) {
+    throw runtime_error( "sendto_batch: count exceeds datagrams" );
+  }
+
+  if ( count == 0 ) {
+    return;
+  }
+
+  prepare_send_batch( count );
+
+  for ( size_t i = 0; i < count; i++ ) {
+    const Address & destination = datagrams[ i ].first;
+    const string & payload = datagrams[ i ].second;
+
+    send_headers_[ i ].msg_hdr.msg_name = const_cast<sockaddr *>( &destination.to_sockaddr() );
+    send_headers_[ i ].msg_hdr.msg_namelen = destination.size();
+    send_iovecs_[ i ].iov_base = const_cast<char *>( payload.data() );
+    send_iovecs_[ i ].iov_len = payload.size();
+  }
+
+  send_prepared_batch( count );
+}
+
+/* send several datagrams to connected address with as few syscalls as possible */
+void UDPSocket::send_batch( const vector<string> & payloads )
+{
+  send_batch( payloads, payloads.size() );
+}
+
+/* send the first `count` payloads */
+void UDPSocket::send_batch( const vector<string> & payloads, const size_t count )
+{
+  if ( count > payloads.size() ) {
+    throw runtime_error( "send_batch: count exceeds payloads" );
+  }
+
+  if ( count == 0 ) {
+    return;
+  }
+
+  prepare_send_batch( count );
+
+  for ( size_t i = 0; i < count; i++ ) {
+    send_iovecs_[ i ].iov_base = const_cast<char *>( payloads[ i ].data() );
+    send_iovecs_[ i ].iov_len = payloads[ i ].size();
+  }
+
+  send_prepared_batch( count );
+}
+
+/* send one buffer that the kernel splits into datagrams (UDP GSO) */
+void UDPSocket::send_segmented( const string & payloads, const uint16_t segment_size )
+{
+  if ( segment_size == 0
+       or payloads.size() > MAX_GSO_BYTES
+       or payloads.size() > MAX_GSO_SEGMENTS * segment_size ) {
+    throw runtime_error( "send_segmented: too many or too large segments for one GSO send" );
+  }
+
+  msghdr header; zero( header );
+  iovec msg_iovec; zero( msg_iovec );
+
+  msg_iovec.iov_base = const_cast<char *>( payloads.data() );
+  msg_iovec.iov_len = payloads.size();
+  header.msg_iov = &msg_iovec;
+  header.msg_iovlen = 1;
+
+  /* tell the kernel the segment size */
+  union {
+    char buf[ CMSG_SPACE( sizeof( uint16_t ) ) ];
+    cmsghdr align;
+  } control;
+  zero( control );
+  header.msg_control = control.buf;
+  header.msg_controllen = sizeof( control.buf );
+
+  cmsghdr * const segment_hdr = CMSG_FIRSTHDR( &header );
+  segment_hdr->cmsg_level = SOL_UDP;
+  segment_hdr->cmsg_type = UDP_SEGMENT;
+  segment_hdr->cmsg_len = CMSG_LEN( sizeof( uint16_t ) );
+  memcpy( CMSG_DATA( segment_hdr ), &segment_size, sizeof( segment_size ) );
+
+  const ssize_t bytes_sent = SystemCall( "sendmsg (UDP_SEGMENT)",
+					 sendmsg( fd_num(), &header, 0 ) );
+
+  /* count each segment as one write */
+  for ( size_t i = 0; i < payloads.size(); i += segment_size ) {
+    register_write();
+  }
+
+  if ( size_t( bytes_sent ) != payloads.size() ) {
+    throw runtime_error( "datagram payloads too big for sendmsg (UDP_SEGMENT)" );
+  }
+}
+
 /* mark the socket as listening for incoming connections */
 void TCPSocket::listen( const int backlog )
 {
@@ -183,6 +491,58 @@ TCPSocket TCPSocket::accept( void )
   return TCPSocket( FileDescriptor( SystemCall( "accept", ::accept( fd_num(), nullptr, nullptr ) ) ) );
 }
 
+/* accept the connections already waiting on a nonblocking socket */
+IOResult TCPSocket::accept_waiting( const Delegate<void(TCPSocket &&)> & accepted, const size_t limit )
+{
+  register_read(); /* (a wakeup that finds none still counts) */
+
+  size_t count = 0;
+  while ( count < limit ) {
+    const int fd = ::accept4( fd_num(), nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK );
+    if ( fd < 0 ) {
+      switch ( errno ) {
+      case ECONNABORTED: /* the client gave up before we got to it */
+      case EINTR:
+      case EPERM:        /* a firewall refused this one connection */
+	/* network errors pending on the new connection, which accept(2)
+	   says to treat like EAGAIN (each is for just one connection) */
+      case EPROTO: case ENOPROTOOPT: case EOPNOTSUPP: case ENETDOWN:
+      case ENETUNREACH: case EHOSTDOWN: case EHOSTUNREACH: case ENONET:
+	continue;
+      }
+
+      const IOResult result = IOResult::from_return( fd );
+      if ( result.would_block() and count > 0 ) {
+	break; /* none left */
+      }
+      return IOResult( result.status, count, result.error );
+    }
+
+    count++;
+    accepted( TCPSocket( FileDescriptor( fd ) ) );
+  }
+
+  return IOResult( IOResult::Status::Done, count );
+}
+
+/* send part of a file, inside the kernel */
+IOResult TCPSocket::send_file( FileDescriptor & file, const uint64_t offset, const size_t length )
+{
+  register_write();
+
+  off_t position = offset;
+  ssize_t sent;
+  do {
+    sent = sendfile( fd_num(), file.fd_num(), &position, length );
+  } while ( sent < 0 and errno == EINTR );
+
+  if ( sent == 0 and length > 0 ) {
+    return IOResult( IOResult::Status::Eof );
+  }
+
+  return IOResult::from_return( sent );
+}
+
 /* set socket option */
 template <typename option_type>
 void Socket::setsockopt( const int level, const int option, const option_type & option_value )
@@ -197,8 +557,134 @@ void Socket::set_reuseaddr( void )
   setsockopt( SOL_SOCKET, SO_REUSEADDR, int( true ) );
 }
 
+/* let several sockets share a local address, with incoming flows spread across them */
+void Socket::set_reuseport( void )
+{
+  setsockopt( SOL_SOCKET, SO_REUSEPORT, int( true ) );
+}
+
+/* prefer this socket for packets processed on `cpu` */
+void Socket::set_incoming_cpu( const int cpu )
+{
+  setsockopt( SOL_SOCKET, SO_INCOMING_CPU, cpu );
+}
+
+/* the CPU that last processed one of this socket's packets (or -1) */
+int Socket::incoming_cpu( void ) const
+{
+  int cpu;
+  socklen_t len = sizeof( cpu );
+  SystemCall( "getsockopt", getsockopt( fd_num(), SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len ) );
+  return cpu;
+}
+
 /* turn on timestamps on receipt */
 void UDPSocket::set_timestamps( void )
 {
   setsockopt( SOL_SOCKET, SO_TIMESTAMPNS, int( true ) );
 }
+
+/* turn on kernel software timestamps for received datagrams and for sends */
+void UDPSocket::set_timestamping( void )
+{
+  setsockopt( SOL_SOCKET, SO_TIMESTAMPING,
+	      int( SOF_TIMESTAMPING_SOFTWARE
+		   | SOF_TIMESTAMPING_RX_SOFTWARE   /* when a datagram arrived */
+		   | SOF_TIMESTAMPING_TX_SOFTWARE   /* when a send reached the device */
+		   | SOF_TIMESTAMPING_OPT_ID        /* number the sends */
+		   | SOF_TIMESTAMPING_OPT_TSONLY ) ); /* without echoing the payload */
+}
+
+/* collect the TX timestamps waiting on the error queue, without blocking */
+size_t UDPSocket::recv_tx_timestamps( vector<tx_timestamp> & timestamps )
+{
+  const size_t BATCH = 64;
+
+  if ( tx_headers_.empty() ) {
+    tx_headers_.resize( BATCH );
+    tx_control_.resize( BATCH * TX_CONTROL_SIZE );
+  }
+
+  size_t total = 0;
+
+  while ( true ) {
+    for ( size_t i = 0; i < BATCH; i++ ) {
+      msghdr & header = tx_headers_[ i ].msg_hdr;
+      zero( header );
+      header.msg_control = &tx_control_[ i * TX_CONTROL_SIZE ];
+      header.msg_controllen = TX_CONTROL_SIZE;
+    }
+
+    const int count = recvmmsg( fd_num(), &tx_headers_[ 0 ], BATCH,
+				MSG_ERRQUEUE | MSG_DONTWAIT, nullptr );
+    if ( count < 0 ) {
+      if ( errno != EAGAIN ) {
+	throw unix_error( "recvmmsg (MSG_ERRQUEUE)" );
+      }
+      break;
+    }
+
+    register_read();
+
+    const int64_t realtime_offset = realtime_offset_ns();
+
+    for ( int i = 0; i < count; i++ ) {
+      msghdr & header = tx_headers_[ i ].msg_hdr;
+      bool have_time = false, have_id = false;
+      tx_timestamp stamp = { 0, 0 };
+
+      for ( cmsghdr * cmsg = CMSG_FIRSTHDR( &header ); cmsg; cmsg = CMSG_NXTHDR( &header, cmsg ) ) {
+	if ( cmsg->cmsg_level == SOL_SOCKET and cmsg->cmsg_type == SCM_TIMESTAMPING ) {
+	  scm_timestamping kernel_times;
+	  memcpy( &kernel_times, CMSG_DATA( cmsg ), sizeof( kernel_times ) );
+	  stamp.timestamp = timestamp_ns( kernel_times.ts[ 0 ], realtime_offset );
+	  have_time = true;
+	} else if ( (cmsg->cmsg_level == SOL_IPV6 and cmsg->cmsg_type == IPV6_RECVERR)
+		    or (cmsg->cmsg_level == SOL_IP and cmsg->cmsg_type == IP_RECVERR) ) {
+	  sock_extended_err error;
+	  memcpy( &error, CMSG_DATA( cmsg ), sizeof( error ) );
+	  if ( error.ee_origin == SO_EE_ORIGIN_TIMESTAMPING ) {
+	    stamp.id = error.ee_data;
+	    have_id = true;
+	  }
+	}
+      }
+
+      if ( have_time and have_id ) {
+	timestamps.push_back( stamp );
+	total++;
+      }
+    }
+
+    if ( size_t( count ) < BATCH ) {
+      break;
+    }
+  }
+
+  /* the error queue was empty, so the error is a real one (which
+     reading SO_ERROR clears, so that the socket stops polling as failed) */
+  if ( total == 0 ) {
+    int error = 0;
+    socklen_t len = sizeof( error );
+    SystemCall( "getsockopt", getsockopt( fd_num(), SOL_SOCKET, SO_ERROR, &error, &len ) );
+    if ( error ) {
+      throw unix_error( "UDPSocket", error );
+    }
+  }
+
+  return total;
+}
+
+/* can this socket do UDP GSO (send_segmented)? */
+bool UDPSocket::gso_supported( void ) const
+{
+  int segment_size;
+  socklen_t len = sizeof( segment_size );
+  return 0 == getsockopt( fd_num(), SOL_UDP, UDP_SEGMENT, &segment_size, &len );
+}
+
+/* let the kernel coalesce received datagrams from the same flow (UDP GRO) */
+void UDPSocket::set_gro( void )
+{
+  setsockopt( SOL_UDP, UDP_GRO, int( true ) );
+}
@@ -2,8 +2,12 @@
 #define SOCKET_HH
 
 #include <functional>
+#include <vector>
+
+#include <sys/socket.h>
 
 #include "address.hh"
+#include "delegate.hh"
 #include "file_descriptor.hh"
 
 /* class for network sockets (UDP, TCP, etc.) */
@@ -38,31 +42,170 @@ public:
 
   /* allow local address to be reused sooner, at the cost of some robustness */
   void set_reuseaddr( void );
+
+  /* let several sockets bind the same address and port (each must ask
+     before binding); the kernel spreads incoming flows across them */
+  void set_reuseport( void );
+
+  /* CPU affinity: prefer this socket for packets the kernel handles on
+     `cpu`, and report which CPU last handled one of its packets */
+  void set_incoming_cpu( const int cpu );
+  int incoming_cpu( void ) const;
 };
 
 /* UDP socket */
 class UDPSocket : public Socket
 {
 public:
-  UDPSocket() : Socket( AF_INET6, SOCK_DGRAM ) {}
+  /* caller-owned storage that received datagrams are written into in place.
+     It is reused from one receive to the next, so receiving allocates nothing. */
+  class ReceiveBuffers
+  {
+  private:
+    friend class UDPSocket;
+
+    size_t mtu_;
+    std::vector<char> payloads_;
+    std::vector<char> control_;
+    std::vector<Address::raw> addresses_;
+    std::vector<iovec> iovecs_;
+    std::vector<mmsghdr> headers_;
+    std::vector<uint64_t> timestamps_;
+    std::vector<size_t> segment_sizes_;
+    size_t count_;
+
+    /* point the message headers at this object's storage */
+    void prepare( void );
+
+  public:
+    /* room for `capacity` datagrams of up to `mtu` bytes each */
+    ReceiveBuffers( const size_t capacity = 1, const size_t mtu = 65536 );
+
+    /* grow (or shrink) to room for `capacity` datagrams */
+    void resize( const size_t capacity );
+
+    /* how many datagrams fit, and how many the last receive delivered */
+    size_t capacity( void ) const { return headers_.size(); }
+    size_t size( void ) const { return count_; }
+
+    /* the i'th datagram of the last receive (valid until the next one) */
+    Address source_address( const size_t i ) const;
+    uint64_t timestamp( const size_t i ) const { return timestamps_.at( i ); } /* see timestamp_ns() */
+    const char * payload( const size_t i ) const { return &payloads_.at( i * mtu_ ); }
+    size_t payload_length( const size_t i ) const { return headers_.at( i ).msg_len; }
+
+    /* with GRO on, a payload may hold several coalesced datagrams, each
+       segment_size() bytes long except possibly the last */
+    size_t segment_size( const size_t i ) const { return segment_sizes_.at( i ); }
+  };
+
+  /* kernel limits on one GSO send */
+  static const size_t MAX_GSO_SEGMENTS = 64;
+  static const size_t MAX_GSO_BYTES = 65507;
+
+private:
+  /* storage behind the string-returning recv() and recv_batch() */
+  ReceiveBuffers recv_buffers_;
+
+  /* scratch space reused across batched sends, so that
+     sendmmsg doesn't need fresh allocations every time */
+  std::vector<iovec> send_iovecs_;
+  std::vector<mmsghdr> send_headers_;
+
+  /* scratch space for reading TX timestamps off the error queue */
+  std::vector<mmsghdr> tx_headers_;
+  std::vector<char> tx_control_;
+
+  /* receive between 1 and max_datagrams datagrams into buffers
+     (with MSG_DONTWAIT in flags, possibly none) */
+  IOResult receive( ReceiveBuffers & buffers, const size_t max_datagrams, const int flags );
+
+  /* prepare the scratch space for a batch of n outgoing messages */
+  void prepare_send_batch( const size_t n );
+
+  /* hand the first n prepared messages to sendmmsg, retrying until all are sent */
+  void send_prepared_batch( const size_t n );
+
+public:
+  UDPSocket()
+    : Socket( AF_INET6, SOCK_DGRAM ),
+      recv_buffers_( 0 ), send_iovecs_(), send_headers_(),
+      tx_headers_(), tx_control_()
+  {}
 
   struct received_datagram {
     Address source_address;
-    uint64_t timestamp;
+    uint64_t timestamp; /* ns since the start of the program (see timestamp_ns()) */
     std::string payload;
   };
 
   /* receive datagram, timestamp, and where it came from */
   received_datagram recv( void );
 
+  /* receive between 1 and max_datagrams datagrams with one syscall
+     (blocks only until the first one arrives) */
+  std::vector<received_datagram> recv_batch( const size_t max_datagrams );
+
+  /* receive between 1 and buffers.capacity() datagrams into caller's buffers,
+     without copying or allocating; returns how many arrived */
+  size_t recv_into( ReceiveBuffers & buffers );
+
+  /* the same, but without waiting or throwing (WouldBlock if nothing is
+     queued, so a callback can drain the socket until then) */
+  IOResult try_recv_into( ReceiveBuffers & buffers );
+
   /* send datagram to specified address */
   void sendto( const Address & peer, const std::string & payload );
 
   /* send datagram to connected address */
   void send( const std::string & payload );
 
+  /* send one datagram without waiting or throwing (WouldBlock if the
+     socket's buffer is full) */
+  IOResult try_sendto( const Address & peer, const std::string & payload );
+  IOResult try_send( const std::string & payload );
+
+  /* send several datagrams, each to its own address, with as few syscalls as possible */
+  void sendto_batch( const std::vector<std::pair<Address, std::string>> & datagrams );
+
+  /* send several datagrams to connected address with as few syscalls as possible */
+  void send_batch( const std::vector<std::string> & payloads );
+
+  /* send just the first `count` entries (so callers can keep reusing
+     one vector, and the strings in it, without shrinking it) */
+  void sendto_batch( const std::vector<std::pair<Address, std::string>> & datagrams,
+		     const size_t count );
+  void send_batch( const std::vector<std::string> & payloads, const size_t count );
+
+  /* send one buffer that the kernel splits into datagrams of segment_size
+     bytes each, the last possibly shorter (UDP GSO), to connected address */
+  void send_segmented( const std::string & payloads, const uint16_t segment_size );
+
   /* turn on timestamps on receipt */
   void set_timestamps( void );
+
+  /* turn on kernel timestamps both on receipt (replacing set_timestamps())
+     and when each send is handed to the network device. Sends are
+     numbered from 0 from then on: one number per datagram, except that
+     a send_segmented() call gets just one. */
+  void set_timestamping( void );
+
+  /* when the kernel handed one send to the network device */
+  struct tx_timestamp {
+    uint32_t id;        /* which send (counting from 0, wrapping around) */
+    uint64_t timestamp; /* ns since the start of the program (see timestamp_ns()) */
+  };
+
+  /* append the TX timestamps waiting on the error queue (poll for them with
+     Poller's Direction::Error), without blocking; returns how many */
+  size_t recv_tx_timestamps( std::vector<tx_timestamp> & timestamps );
+
+  /* can this socket do UDP GSO (send_segmented)? */
+  bool gso_supported( void ) const;
+
+  /* let the kernel coalesce received datagrams from the same flow (UDP GRO);
+     only useful with recv_into(), which reports the segment size */
+  void set_gro( void );
 };
 
 /* TCP socket */
@@ -80,6 +223,20 @@ public:
 
   /* accept a new incoming connection */
   TCPSocket accept( void );
+
+  /* on a nonblocking listening socket: accept the connections that are
+     already waiting (at most `limit`), as nonblocking sockets, handing
+     each to `accepted`. Done (with how many) if there were any,
+     WouldBlock if not, Error if accepting failed (after `count`). A
+     connection that fails on its own (reset, refused by a firewall,
+     network error) is skipped. */
+  IOResult accept_waiting( const Delegate<void(TCPSocket &&)> & accepted, const size_t limit );
+
+  /* send up to `length` bytes of `file`, from `offset`, without copying
+     them through user space (sendfile). On a nonblocking socket, sends
+     what fits (Done: how many bytes) or would_block(); Eof if the file
+     ends before `offset`. */
+  IOResult send_file( FileDescriptor & file, const uint64_t offset, const size_t length );
 };
 
 #endif /* SOCKET_HH */
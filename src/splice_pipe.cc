@@ -0,0 +1,132 @@
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "splice_pipe.hh"
+#include "util.hh"
+
+using namespace std;
+using namespace PollerShortNames;
+
+/* the read and write ends of a new nonblocking pipe */
+static pair<FileDescriptor, FileDescriptor> make_pipe( void )
+{
+  int ends[ 2 ];
+  SystemCall( "pipe2", pipe2( ends, O_NONBLOCK | O_CLOEXEC ) );
+  return make_pair( FileDescriptor( ends[ 0 ] ), FileDescriptor( ends[ 1 ] ) );
+}
+
+/* why an fd polled as failed (SO_ERROR, which reading clears), or
+   EPIPE if it only hung up */
+static int pending_error( FileDescriptor & fd )
+{
+  int error = 0;
+  socklen_t len = sizeof( error );
+  if ( getsockopt( fd.fd_num(), SOL_SOCKET, SO_ERROR, &error, &len ) < 0 ) {
+    error = errno; /* (not a socket) */
+  }
+  return error ? error : EPIPE;
+}
+
+SplicePipe::SplicePipe( const size_t capacity )
+  : SplicePipe( make_pipe(), capacity )
+{}
+
+SplicePipe::SplicePipe( pair<FileDescriptor, FileDescriptor> && ends, const size_t capacity )
+  : read_end_( move( ends.first ) ),
+    write_end_( move( ends.second ) ),
+    capacity_( 0 ),
+    buffered_( 0 ),
+    poller_( nullptr ),
+    fill_action_( 0 ),
+    drain_action_( 0 ),
+    error_actions_(),
+    finished_()
+{
+  /* an unprivileged process may not grow a pipe past
+     /proc/sys/fs/pipe-max-size; then keep the default size */
+  int size = fcntl( write_end_.fd_num(), F_SETPIPE_SZ, static_cast<int>( capacity ) );
+  if ( size < 0 ) {
+    size = SystemCall( "fcntl F_GETPIPE_SZ", fcntl( write_end_.fd_num(), F_GETPIPE_SZ ) );
+  }
+  capacity_ = size;
+}
+
+IOResult SplicePipe::fill( FileDescriptor & source )
+{
+  const IOResult result = source.splice_to( write_end_, capacity_ - buffered_ );
+  if ( result.done() ) {
+    buffered_ += result.count;
+  }
+  return result;
+}
+
+IOResult SplicePipe::drain( FileDescriptor & destination )
+{
+  const IOResult result = read_end_.splice_to( destination, buffered_ );
+  if ( result.done() ) {
+    buffered_ -= result.count;
+  }
+  return result;
+}
+
+void SplicePipe::relay( Poller & poller, FileDescriptor & from, FileDescriptor & to,
+			const Delegate<void(const IOResult &)> & finished )
+{
+  stop();
+  poller_ = &poller;
+  finished_ = finished;
+
+  fill_action_ = poller.add_action( Action( from, Direction::In,
+    [this, &from] () {
+      const IOResult result = fill( from );
+      if ( result.failed() ) {
+	finish( result );
+      } else if ( result.eof() and empty() ) {
+	finish( result );
+      }
+      return ResultType::Continue;
+    },
+    [this] () { return not full(); } ) );
+
+  drain_action_ = poller.add_action( Action( to, Direction::Out,
+    [this, &from, &to] () {
+      const IOResult result = drain( to );
+      if ( result.failed() ) {
+	finish( result );
+      } else if ( from.eof() and empty() ) {
+	finish( IOResult( IOResult::Status::Eof ) );
+      }
+      return ResultType::Continue;
+    },
+    [this] () { return not empty(); } ) );
+
+  /* a reset (or hangup) on either end ends the relay, rather than
+     making poll() exit */
+  for ( FileDescriptor * const fd : { &from, &to } ) {
+    error_actions_[ fd == &to ] = poller.add_action( Action( *fd, Direction::Error,
+      [this, fd] () {
+	finish( IOResult( IOResult::Status::Error, 0, pending_error( *fd ) ) );
+	return ResultType::Continue;
+      } ) );
+  }
+}
+
+void SplicePipe::stop( void )
+{
+  if ( poller_ ) {
+    poller_->remove_action( fill_action_ );
+    poller_->remove_action( drain_action_ );
+    poller_->remove_action( error_actions_[ 0 ] );
+    poller_->remove_action( error_actions_[ 1 ] );
+    poller_ = nullptr;
+  }
+}
+
+void SplicePipe::finish( const IOResult & result )
+{
+  stop();
+  finished_( result );
+}
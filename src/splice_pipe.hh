@@ -0,0 +1,68 @@
+#ifndef SPLICE_PIPE_HH
+#define SPLICE_PIPE_HH
+
+#include <utility>
+
+#include "delegate.hh"
+#include "file_descriptor.hh"
+#include "poller.hh"
+
+/* A pipe used as a kernel-side buffer, for relaying a stream from one
+   fd to another (e.g. socket to socket) with splice(), so the bytes are
+   never copied through user space. fill() moves what the source has
+   into the pipe and drain() moves what the pipe holds to the
+   destination; both are nonblocking, so the fds should be too.
+
+   relay() drives the two from a Poller: the source is read while the
+   pipe has room and the destination written while the pipe holds
+   something, so a slow destination holds back the source. `finished`
+   is called once, with Eof when the source has ended and everything it
+   sent has been passed on, or with the error that stopped the relay
+   (including a reset or hangup on either fd). */
+class SplicePipe
+{
+private:
+  FileDescriptor read_end_, write_end_;
+  size_t capacity_;
+  size_t buffered_; /* bytes in the pipe */
+
+  /* the relay being driven, if any */
+  Poller * poller_;
+  Poller::ActionHandle fill_action_, drain_action_;
+  Poller::ActionHandle error_actions_[ 2 ]; /* on `from`, and on `to` */
+  Delegate<void(const IOResult &)> finished_;
+
+  void finish( const IOResult & result );
+
+  SplicePipe( std::pair<FileDescriptor, FileDescriptor> && ends, const size_t capacity );
+
+public:
+  /* the kernel may round the capacity up, or refuse to grow the pipe */
+  explicit SplicePipe( const size_t capacity = 1024 * 1024 );
+
+  size_t capacity( void ) const { return capacity_; }
+  size_t buffered( void ) const { return buffered_; }
+  bool empty( void ) const { return buffered_ == 0; }
+  bool full( void ) const { return buffered_ >= capacity_; }
+
+  /* move what fits from `source` into the pipe (Done: how many bytes) */
+  IOResult fill( FileDescriptor & source );
+
+  /* move what `destination` will take out of the pipe */
+  IOResult drain( FileDescriptor & destination );
+
+  /* relay everything `from` sends to `to` (both must outlive the relay) */
+  void relay( Poller & poller, FileDescriptor & from, FileDescriptor & to,
+	      const Delegate<void(const IOResult &)> & finished );
+
+  /* stop relaying (without calling `finished`) */
+  void stop( void );
+
+  ~SplicePipe() { stop(); }
+
+  /* forbid copying SplicePipe objects or assigning them */
+  SplicePipe( const SplicePipe & other ) = delete;
+  const SplicePipe & operator=( const SplicePipe & other ) = delete;
+};
+
+#endif /* SPLICE_PIPE_HH */
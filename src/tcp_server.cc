@@ -0,0 +1,213 @@
+#include <csignal>
+#include <new>
+#include <stdexcept>
+
+#include "tcp_server.hh"
+#include "util.hh"
+
+using namespace std;
+using namespace PollerShortNames;
+
+/* connections queued in the kernel before the server gets to them (per worker) */
+static const int LISTEN_BACKLOG = 1024;
+
+/* connections accepted per wakeup, so a flood of them can't starve the rest */
+static const size_t ACCEPT_BATCH = 64;
+
+/* how long to stop accepting when out of file descriptors or memory */
+static const uint64_t ACCEPT_PAUSE_NS = 100 * uint64_t( 1000000 );
+
+TCPConnection::TCPConnection()
+  : socket_storage_(),
+    open_( false ),
+    server_( nullptr ),
+    worker_( nullptr ),
+    shard_( 0 ),
+    output_()
+{}
+
+TCPConnection::~TCPConnection()
+{
+  if ( open_ ) {
+    socket().~TCPSocket();
+  }
+}
+
+void TCPConnection::open( TCPServer & server, Runtime::Worker & worker, const size_t shard, TCPSocket && socket )
+{
+  new (&socket_storage_) TCPSocket( move( socket ) );
+  open_ = true;
+  server_ = &server;
+  worker_ = &worker;
+  shard_ = shard;
+
+  TCPConnection * const self = this;
+  worker.poller().add_action( Action( this->socket(), Direction::In, [self] () {
+	self->service( &TCPConnection::readable );
+	return ResultType::Continue;
+      },
+      [self] () { return not self->output_.paused(); } ) );
+  worker.poller().add_action( Action( this->socket(), Direction::Out, [self] () {
+	self->send_ready();
+	return ResultType::Continue;
+      },
+      [self] () { return not self->output_.empty() or self->wants_to_write(); } ) );
+  worker.poller().add_action( Action( this->socket(), Direction::Error, [self] () {
+	/* reset, or hung up (anything left to read was read just before) */
+	self->close();
+	return ResultType::Continue;
+      } ) );
+
+  service( &TCPConnection::opened );
+}
+
+void TCPConnection::service( void (TCPConnection::*handler)( void ) )
+{
+  try {
+    (this->*handler)();
+  } catch ( const exception & e ) {
+    print_exception( e );
+    if ( open_ ) {
+      close();
+    }
+  }
+
+  /* whatever the handler queued goes out together */
+  if ( open_ and not output_.empty() ) {
+    flush();
+  }
+}
+
+void TCPConnection::flush( void )
+{
+  const IOResult result = output_.flush( socket() );
+  if ( result.failed() ) {
+    /* (the client is gone, e.g. EPIPE or ECONNRESET) */
+    close();
+  }
+}
+
+void TCPConnection::send_ready( void )
+{
+  if ( output_.empty() ) {
+    service( &TCPConnection::writable );
+  } else {
+    flush();
+  }
+}
+
+void TCPConnection::close( void )
+{
+  if ( not open_ ) {
+    throw runtime_error( "TCPConnection::close: not open" );
+  }
+
+  try {
+    closed();
+  } catch ( const exception & e ) { /* close anyway */
+    print_exception( e );
+  }
+
+  /* the socket's close hook takes its actions out of the Poller */
+  output_.clear();
+  open_ = false;
+  socket().~TCPSocket();
+  server_->release( *this );
+}
+
+TCPServer::TCPServer( const Address & address, const Factory & factory, const size_t workers )
+  : runtime_( workers ),
+    factory_( factory ),
+    shards_()
+{
+  /* a write to a client that has gone away should fail (EPIPE), not kill the server */
+  if ( signal( SIGPIPE, SIG_IGN ) == SIG_ERR ) {
+    throw unix_error( "signal" );
+  }
+
+  /* every worker listens on the same address, with its own socket */
+  for ( size_t i = 0; i < runtime_.size(); i++ ) {
+    shards_.emplace_back( new Shard );
+    TCPSocket & listener = shards_.back()->listener;
+
+    listener.set_reuseaddr();
+    listener.set_reuseport();
+    listener.bind( i == 0 ? address : local_address() ); /* (the port the first one got) */
+    listener.listen( LISTEN_BACKLOG );
+    listener.set_blocking( false );
+  }
+
+  for ( size_t i = 0; i < runtime_.size(); i++ ) {
+    Shard & shard = *shards_.at( i );
+    runtime_.worker( i ).post( [this, &shard] ( Runtime::Worker & worker ) { start( worker, shard ); } );
+  }
+}
+
+TCPServer::~TCPServer()
+{
+  try {
+    runtime_.stop();
+
+    /* (the workers are gone, so their connections are ours to close) */
+    for ( auto & shard : shards_ ) {
+      for ( auto & connection : shard->connections ) {
+	if ( connection->is_open() ) {
+	  connection->close();
+	}
+      }
+    }
+  } catch ( const exception & e ) { /* don't throw from destructor */
+    print_exception( e );
+  }
+}
+
+void TCPServer::start( Runtime::Worker & worker, Shard & shard )
+{
+  /* prefer the listening socket for connections the kernel handles on this worker's core */
+  if ( worker.cpu() >= 0 ) {
+    shard.listener.set_incoming_cpu( worker.cpu() );
+  }
+
+  const size_t shard_index = worker.index();
+  Shard * const shard_pointer = &shard;
+  worker.poller().add_action( Action( shard.listener, Direction::In, [this, &worker, shard_index] () {
+	accept( worker, shard_index );
+	return ResultType::Continue;
+      },
+      [shard_pointer] () { return shard_pointer->accepting; } ) );
+}
+
+void TCPServer::accept( Runtime::Worker & worker, const size_t shard_index )
+{
+  Shard & shard = *shards_.at( shard_index );
+
+  const IOResult result = shard.listener.accept_waiting(
+    [this, &worker, &shard, shard_index] ( TCPSocket && socket ) {
+      if ( shard.idle.empty() ) {
+	shard.connections.emplace_back( factory_() );
+	shard.idle.push_back( shard.connections.back().get() );
+      }
+
+      TCPConnection * const connection = shard.idle.back();
+      shard.idle.pop_back();
+      connection->open( *this, worker, shard_index, move( socket ) );
+    }, ACCEPT_BATCH );
+
+  if ( result.failed() ) {
+    /* out of fds or memory for now: anything else is a bug (e.g. EBADF) */
+    if ( result.error != EMFILE and result.error != ENFILE
+	 and result.error != ENOBUFS and result.error != ENOMEM ) {
+      result.check( "accept4" );
+    }
+
+    /* the connections stay queued in the kernel until some are freed */
+    print_exception( unix_error( "accept4", result.error ) );
+    shard.accepting = false;
+    worker.poller().add_timer( ACCEPT_PAUSE_NS, [&shard] () { shard.accepting = true; } );
+  }
+}
+
+void TCPServer::release( TCPConnection & connection )
+{
+  shards_.at( connection.shard_ )->idle.push_back( &connection );
+}
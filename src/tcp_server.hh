@@ -0,0 +1,153 @@
+#ifndef TCP_SERVER_HH
+#define TCP_SERVER_HH
+
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "delegate.hh"
+#include "output_queue.hh"
+#include "runtime.hh"
+#include "socket.hh"
+
+class TCPServer;
+
+/* One connection's state, subclassed by the application, which handles
+   the socket's events in readable() and writable(). The socket is
+   nonblocking (so the handlers use read_some() or read_into()), and
+   replies go in output(): after each handler, the server sends what
+   it can with one writev, and the rest when the socket has room.
+   While output() is over its high watermark, readable() waits, so a
+   client that doesn't read its replies can't run up the server's
+   memory. The objects are pooled: once closed, a connection's object
+   (everything but its socket) waits for the next connection on the
+   same worker, so a server whose pools are warm makes no new ones. */
+class TCPConnection
+{
+private:
+  friend class TCPServer;
+
+  /* the socket, when open (constructed in place, so the object outlives it) */
+  std::aligned_storage<sizeof( TCPSocket ), alignof( TCPSocket )>::type socket_storage_;
+  bool open_;
+
+  TCPServer * server_;
+  Runtime::Worker * worker_;
+  size_t shard_;
+
+  OutputQueue output_;
+
+  /* (server only) take on a new connection, and tell the subclass */
+  void open( TCPServer & server, Runtime::Worker & worker, const size_t shard, TCPSocket && socket );
+
+  /* run one of the subclass's event handlers, closing the
+     connection if it throws (so one client can't stop a worker) */
+  void service( void (TCPConnection::*handler)( void ) );
+
+  /* send what output() holds, as far as the socket will take it */
+  void flush( void );
+
+  /* the socket has room: for output(), or else for writable() */
+  void send_ready( void );
+
+public:
+  TCPConnection();
+  virtual ~TCPConnection();
+
+  bool is_open( void ) const { return open_; }
+
+  /* (while open) the connection's socket, and the worker it belongs to */
+  TCPSocket & socket( void ) { return *reinterpret_cast<TCPSocket *>( &socket_storage_ ); }
+  Runtime::Worker & worker( void ) { return *worker_; }
+
+  /* what waits to be sent (see OutputQueue for the watermarks) */
+  OutputQueue & output( void ) { return output_; }
+
+  /* close the socket (its Poller actions go with it) and return this
+     object to the pool; safe from the connection's own handlers */
+  void close( void );
+
+  /* a new connection has this object: reset any state left from the last one */
+  virtual void opened( void ) {}
+
+  /* the socket has data, or the peer has closed it (socket().eof()
+     after a read); not called while output() is paused */
+  virtual void readable( void ) = 0;
+
+  /* output() is empty and the socket has room, while wants_to_write()
+     (for a connection that makes its output as it goes, e.g. a
+     file sent a piece at a time with socket().send_file()) */
+  virtual bool wants_to_write( void ) { return false; }
+  virtual void writable( void ) {}
+
+  /* the connection is closing (the socket is still open) */
+  virtual void closed( void ) {}
+
+  /* forbid copying */
+  TCPConnection( const TCPConnection & other ) = delete;
+  const TCPConnection & operator=( const TCPConnection & other ) = delete;
+};
+
+/* An event-driven TCP server: one pinned event loop per worker thread
+   (see Runtime), each with its own listening socket on the same port
+   (SO_REUSEPORT), so the kernel spreads new connections across workers
+   and each worker accepts and serves its own, without locks or threads
+   per connection. */
+class TCPServer
+{
+public:
+  /* makes a connection object, when a worker's pool is empty */
+  typedef Delegate<TCPConnection *(void)> Factory;
+
+private:
+  /* one worker's listening socket and connections (that worker's thread only) */
+  struct Shard
+  {
+    TCPSocket listener;
+    bool accepting;
+    std::vector<std::unique_ptr<TCPConnection>> connections; /* every one made */
+    std::vector<TCPConnection *> idle;                        /* the closed ones */
+
+    Shard() : listener(), accepting( true ), connections(), idle() {}
+  };
+
+  /* (declared first, so destroyed last: the sockets use its Pollers) */
+  Runtime runtime_;
+  Factory factory_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+
+  /* start listening on a worker (on its thread) */
+  void start( Runtime::Worker & worker, Shard & shard );
+
+  /* accept what's waiting on a worker's listening socket */
+  void accept( Runtime::Worker & worker, const size_t shard_index );
+
+  /* a connection was closed */
+  friend class TCPConnection;
+  void release( TCPConnection & connection );
+
+public:
+  /* listen on `address` (port 0: any free port) with `workers` threads,
+     serving each connection with an object from `factory` */
+  TCPServer( const Address & address, const Factory & factory,
+	     const size_t workers = std::thread::hardware_concurrency() );
+
+  /* stops the workers, then closes every connection */
+  ~TCPServer();
+
+  Address local_address( void ) const { return shards_.front()->listener.local_address(); }
+  size_t size( void ) const { return runtime_.size(); }
+
+  /* the workers, e.g. to post other work to them */
+  Runtime & runtime( void ) { return runtime_; }
+
+  /* wait until the workers stop (e.g. from the main thread) */
+  void wait( void ) { runtime_.wait(); }
+
+  /* forbid copying */
+  TCPServer( const TCPServer & other ) = delete;
+  const TCPServer & operator=( const TCPServer & other ) = delete;
+};
+
+#endif /* TCP_SERVER_HH */
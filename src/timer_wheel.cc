@@ -0,0 +1,202 @@
+#include <algorithm>
+
+#include "timer_wheel.hh"
+
+using namespace std;
+
+TimerWheel::TimerWheel( const uint64_t now_ns )
+  : nodes_(),
+    free_nodes_(),
+    heads_( LEVELS * SLOTS, NIL ),
+    occupied_(),
+    current_tick_( now_ns / TICK_NS ),
+    size_( 0 )
+{}
+
+void TimerWheel::link( const uint32_t index )
+{
+  Node & node = nodes_[ index ];
+  node.prev = NIL;
+  node.next = heads_[ node.list ];
+  if ( node.next != NIL ) {
+    nodes_[ node.next ].prev = index;
+  }
+  heads_[ node.list ] = index;
+
+  occupied_[ node.list / SLOTS ][ (node.list % SLOTS) / 64 ] |= uint64_t( 1 ) << (node.list % 64);
+}
+
+void TimerWheel::unlink( const uint32_t index )
+{
+  Node & node = nodes_[ index ];
+  if ( node.prev != NIL ) {
+    nodes_[ node.prev ].next = node.next;
+  } else {
+    heads_[ node.list ] = node.next;
+  }
+  if ( node.next != NIL ) {
+    nodes_[ node.next ].prev = node.prev;
+  }
+
+  if ( heads_[ node.list ] == NIL ) {
+    occupied_[ node.list / SLOTS ][ (node.list % SLOTS) / 64 ] &= ~(uint64_t( 1 ) << (node.list % 64));
+  }
+}
+
+/* return an unlinked node to the free list, invalidating its handles */
+void TimerWheel::release( const uint32_t index )
+{
+  Node & node = nodes_[ index ];
+  node.generation++;
+  node.list = NIL;
+  node.callback = nullptr;
+  free_nodes_.push_back( index );
+  size_--;
+}
+
+/* put a node in the right slot for its tick (which must not be in the past) */
+void TimerWheel::place( const uint32_t index )
+{
+  Node & node = nodes_[ index ];
+
+  /* timers beyond the wheel's range wait in the top level and get cascaded again */
+  const uint64_t range = uint64_t( 1 ) << (SLOT_BITS * LEVELS);
+  const uint64_t diff = min( node.tick - current_tick_, range - 1 );
+  const uint64_t placement_tick = current_tick_ + diff;
+
+  unsigned int level = 0;
+  while ( level < LEVELS - 1 and diff >= (uint64_t( 1 ) << (SLOT_BITS * (level + 1))) ) {
+    level++;
+  }
+
+  node.list = level * SLOTS + ((placement_tick >> (SLOT_BITS * level)) & (SLOTS - 1));
+  link( index );
+}
+
+/* redistribute the slot of `level` that the current tick has just reached */
+void TimerWheel::cascade( const unsigned int level )
+{
+  const uint32_t list = level * SLOTS + ((current_tick_ >> (SLOT_BITS * level)) & (SLOTS - 1));
+
+  uint32_t index = heads_[ list ];
+  heads_[ list ] = NIL;
+  occupied_[ level ][ (list % SLOTS) / 64 ] &= ~(uint64_t( 1 ) << (list % 64));
+
+  while ( index != NIL ) {
+    const uint32_t next = nodes_[ index ].next;
+    place( index );
+    index = next;
+  }
+}
+
+/* run every timer on one list */
+void TimerWheel::fire( const uint32_t list )
+{
+  while ( heads_[ list ] != NIL ) {
+    const uint32_t index = heads_[ list ];
+    unlink( index );
+
+    /* the callback may schedule new timers (and so reuse this node) */
+    const Callback callback = move( nodes_[ index ].callback );
+    release( index );
+    callback();
+  }
+}
+
+/* first tick at which a wheel slot needs attention (fire or cascade), or -1 */
+uint64_t TimerWheel::next_event_tick( void ) const
+{
+  uint64_t ret = -1;
+
+  for ( unsigned int level = 0; level < LEVELS; level++ ) {
+    const unsigned int shift = SLOT_BITS * level;
+    const uint64_t position = current_tick_ >> shift;
+    const unsigned int current_slot = position & (SLOTS - 1);
+
+    /* find the next occupied slot after the current one, wrapping around */
+    for ( unsigned int distance = 1; distance <= SLOTS; ) {
+      const unsigned int slot = (current_slot + distance) & (SLOTS - 1);
+      const uint64_t bits = occupied_[ level ][ slot / 64 ] >> (slot % 64);
+      if ( bits ) {
+	distance += __builtin_ctzll( bits );
+	ret = min( ret, (position + distance) << shift );
+	break;
+      }
+      distance += 64 - (slot % 64);
+    }
+  }
+
+  return ret;
+}
+
+/* run callback at (or just after) `expiry_ns` */
+TimerWheel::Handle TimerWheel::schedule( const uint64_t expiry_ns, const Callback & callback )
+{
+  uint32_t index;
+  if ( free_nodes_.empty() ) {
+    index = nodes_.size();
+    nodes_.push_back( { 0, 0, NIL, NIL, NIL, nullptr } );
+  } else {
+    index = free_nodes_.back();
+    free_nodes_.pop_back();
+  }
+
+  Node & node = nodes_[ index ];
+
+  /* round up to a tick; anything already due fires on the next one */
+  node.tick = max( (expiry_ns + TICK_NS - 1) / TICK_NS, current_tick_ + 1 );
+  node.callback = callback;
+  place( index );
+  size_++;
+
+  return (uint64_t( node.generation ) << 32) | index;
+}
+
+/* stop a timer; false if it already fired or was cancelled */
+bool TimerWheel::cancel( const Handle handle )
+{
+  const uint32_t index = handle & 0xffffffff;
+  const uint32_t generation = handle >> 32;
+
+  if ( index >= nodes_.size()
+       or nodes_[ index ].generation != generation
+       or nodes_[ index ].list == NIL ) {
+    return false;
+  }
+
+  unlink( index );
+  release( index );
+  return true;
+}
+
+/* run the callbacks of every timer due by `now_ns` */
+void TimerWheel::advance( const uint64_t now_ns )
+{
+  const uint64_t target = now_ns / TICK_NS;
+
+  /* skip straight over ticks with nothing to do */
+  while ( current_tick_ < target ) {
+    const uint64_t next = next_event_tick();
+    if ( next > target ) {
+      current_tick_ = target;
+      break;
+    }
+
+    current_tick_ = next;
+
+    for ( unsigned int level = LEVELS - 1; level > 0; level-- ) {
+      if ( (current_tick_ & ((uint64_t( 1 ) << (SLOT_BITS * level)) - 1)) == 0 ) {
+	cascade( level );
+      }
+    }
+
+    fire( current_tick_ & (SLOTS - 1) );
+  }
+}
+
+/* earliest time a pending timer could be due (or -1 if none pending) */
+uint64_t TimerWheel::next_expiry_ns( void ) const
+{
+  const uint64_t tick = next_event_tick();
+  return tick == uint64_t( -1 ) ? tick : tick * TICK_NS;
+}
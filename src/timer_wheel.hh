@@ -0,0 +1,84 @@
+#ifndef TIMER_WHEEL_HH
+#define TIMER_WHEEL_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "delegate.hh"
+
+/* Hierarchical timing wheel: O(1) schedule and cancel, with
+   expirations rounded up to a tick of about a microsecond */
+class TimerWheel
+{
+public:
+  typedef Delegate<void(void)> Callback;
+
+  /* identifies one scheduled timer; stale handles are harmless */
+  typedef uint64_t Handle;
+
+  /* nanoseconds per tick */
+  static const uint64_t TICK_NS = 1024;
+
+private:
+  static const unsigned int LEVELS = 4;
+  static const unsigned int SLOT_BITS = 8;
+  static const unsigned int SLOTS = 1 << SLOT_BITS;
+
+  static const uint32_t NIL = -1;
+
+  struct Node
+  {
+    uint64_t tick;
+    uint32_t generation;
+    uint32_t list;
+    uint32_t prev, next;
+    Callback callback;
+  };
+
+  std::vector<Node> nodes_;
+  std::vector<uint32_t> free_nodes_;
+
+  std::vector<uint32_t> heads_;               /* first node of each slot */
+  uint64_t occupied_[ LEVELS ][ SLOTS / 64 ]; /* which slots are non-empty */
+
+  uint64_t current_tick_;
+  size_t size_;
+
+  void link( const uint32_t index );
+  void unlink( const uint32_t index );
+  void release( const uint32_t index );
+
+  /* put a node in the right slot for its tick (which must not be in the past) */
+  void place( const uint32_t index );
+
+  /* redistribute the slot of `level` that the current tick has just reached */
+  void cascade( const unsigned int level );
+
+  /* run every timer on one list */
+  void fire( const uint32_t list );
+
+  /* first tick at which a slot needs attention (fire or cascade), or -1 */
+  uint64_t next_event_tick( void ) const;
+
+public:
+  /* the wheel starts at `now_ns` (any monotonic clock) */
+  TimerWheel( const uint64_t now_ns );
+
+  /* run callback at (or just after) `expiry_ns` */
+  Handle schedule( const uint64_t expiry_ns, const Callback & callback );
+
+  /* stop a timer; false if it already fired or was cancelled */
+  bool cancel( const Handle handle );
+
+  /* run the callbacks of every timer due by `now_ns` */
+  void advance( const uint64_t now_ns );
+
+  /* earliest time a pending timer could be due (or -1 if none pending) */
+  uint64_t next_expiry_ns( void ) const;
+
+  size_t size( void ) const { return size_; }
+  bool empty( void ) const { return size_ == 0; }
+};
+
+#endif /* TIMER_WHEEL_HH */
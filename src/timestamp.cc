@@ -10,27 +10,61 @@ static const uint64_t MILLION = 1000000;
 static const uint64_t BILLION = 1000 * MILLION;
 
 /* helper functions */
-static timespec current_time( void )
+static uint64_t to_ns( const timespec & ts )
+{
+  return ts.tv_sec * BILLION + ts.tv_nsec;
+}
+
+static uint64_t clock_ns( const clockid_t clock )
 {
   timespec ret;
-  SystemCall( "clock_gettime", clock_gettime( CLOCK_REALTIME, &ret ) );
-  return ret;
+  SystemCall( "clock_gettime", clock_gettime( clock, &ret ) );
+  return to_ns( ret );
 }
 
-static uint64_t timestamp_ms_raw( const timespec & ts )
+/* Current CLOCK_MONOTONIC time in nanoseconds */
+uint64_t monotonic_ns( void )
 {
-  const uint64_t nanos = ts.tv_sec * BILLION + ts.tv_nsec;
-  return nanos / MILLION;
+  return clock_ns( CLOCK_MONOTONIC );
 }
 
-/* Current time in milliseconds since the start of the program */
-uint64_t timestamp_ms( void )
+/* the start of the program (set on first use, so that a static
+   initializer elsewhere that takes a timestamp still sees it set) */
+static uint64_t epoch( void )
+{
+  static const uint64_t start = monotonic_ns();
+  return start;
+}
+
+/* ... which is at load at the latest (so kernel stamps taken before the
+   first timestamp the program asks for still come after it) */
+static const uint64_t EPOCH_AT_LOAD = epoch();
+
+/* Current time in nanoseconds since the start of the program */
+uint64_t timestamp_ns( void )
 {
-  return timestamp_ms( current_time() );
+  const uint64_t start = epoch();
+  return monotonic_ns() - start;
 }
 
-uint64_t timestamp_ms( const timespec & ts )
+/* CLOCK_REALTIME minus CLOCK_MONOTONIC right now */
+int64_t realtime_offset_ns( void )
+{
+  const uint64_t monotonic = monotonic_ns();
+  return clock_ns( CLOCK_REALTIME ) - monotonic;
+}
+
+/* A kernel (wall-clock) timestamp in nanoseconds since the start of the program */
+uint64_t timestamp_ns( const timespec & realtime, const int64_t realtime_offset )
+{
+  /* (a stamp from before the epoch counts as taken at it) */
+  const int64_t monotonic = to_ns( realtime ) - realtime_offset;
+  const uint64_t start = epoch();
+  return monotonic > int64_t( start ) ? monotonic - start : 0;
+}
+
+/* Current time in milliseconds since the start of the program */
+uint64_t timestamp_ms( void )
 {
-  const static uint64_t EPOCH = timestamp_ms_raw( current_time() );
-  return timestamp_ms_raw( ts ) - EPOCH;
+  return timestamp_ns() / MILLION;
 }
@@ -4,8 +4,25 @@
 #include <ctime>
 #include <cstdint>
 
-/* Current time in milliseconds since the start of the program */
+/* Times come from CLOCK_MONOTONIC, which wall-clock changes can't move.
+   glibc answers clock_gettime() from the vDSO (reading the TSC where the
+   kernel trusts it), so none of these makes a system call. */
+
+/* Current CLOCK_MONOTONIC time in nanoseconds */
+uint64_t monotonic_ns( void );
+
+/* Current time in nanoseconds since the start of the program */
+uint64_t timestamp_ns( void );
+
+/* CLOCK_REALTIME minus CLOCK_MONOTONIC right now, for converting
+   kernel timestamps (which are wall-clock) to monotonic time */
+int64_t realtime_offset_ns( void );
+
+/* A kernel timestamp (e.g. SO_TIMESTAMPNS) in nanoseconds since the
+   start of the program, given a recent realtime_offset_ns() */
+uint64_t timestamp_ns( const timespec & realtime, const int64_t realtime_offset );
+
+/* Current time in milliseconds since the start of the program (for display) */
 uint64_t timestamp_ms( void );
-uint64_t timestamp_ms( const timespec & ts );
 
 #endif /* TIMESTAMP_HH */
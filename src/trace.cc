@@ -0,0 +1,159 @@
+#include <chrono>
+#include <stdexcept>
+
+#include <fcntl.h>
+
+#include "trace.hh"
+#include "util.hh"
+
+using namespace std;
+
+/* the file: a text header naming the events, then the records, as is */
+static const char TRACE_MAGIC[] = "sourdough-trace 1\n";
+
+static vector<const TraceEvent *> & event_registry( void )
+{
+  static vector<const TraceEvent *> registry;
+  return registry;
+}
+
+/* written when the log closes, for each thread whose ring overflowed */
+static const TraceEvent DROPPED( "dropped", "records:u" );
+
+TraceEvent::TraceEvent( const char * const name, const char * const fields )
+  : id_( event_registry().size() ),
+    name_( name ),
+    fields_( fields )
+{
+  event_registry().push_back( this );
+}
+
+const vector<const TraceEvent *> & TraceEvent::all( void )
+{
+  return event_registry();
+}
+
+atomic<TraceLog *> TraceLog::active_( nullptr );
+atomic<uint64_t> TraceLog::generation_counter_( 0 );
+thread_local TraceLog::ThreadRing TraceLog::this_thread_ring_ = { 0, nullptr };
+
+TraceLog::Ring::Ring( const unsigned int capacity_log2, const uint32_t s_thread )
+  : slots( size_t( 1 ) << capacity_log2 ),
+    mask( (uint64_t( 1 ) << capacity_log2) - 1 ),
+    thread( s_thread ),
+    tail( 0 ),
+    dropped( 0 ),
+    padding(),
+    head( 0 )
+{}
+
+TraceLog::TraceLog( const string & filename, const unsigned int ring_capacity_log2 )
+  : file_( SystemCall( "open " + filename,
+		       open( filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 ) ) ),
+    ring_capacity_log2_( ring_capacity_log2 ),
+    generation_( ++generation_counter_ ),
+    rings_mutex_(),
+    rings_(),
+    stopping_( false ),
+    writer_()
+{
+  /* describe the events, so the file decodes without this program */
+  string header = TRACE_MAGIC;
+  for ( const TraceEvent * const event : TraceEvent::all() ) {
+    header += "event " + to_string( event->id() ) + " " + event->name() + " " + event->fields() + "\n";
+  }
+  header += "records\n";
+  file_.write( header );
+
+  TraceLog * expected = nullptr;
+  if ( not active_.compare_exchange_strong( expected, this ) ) {
+    throw runtime_error( "TraceLog: another log is already open" );
+  }
+
+  writer_ = thread( [this] () { write_loop(); } );
+}
+
+TraceLog::~TraceLog()
+{
+  active_.store( nullptr, memory_order_release );
+
+  stopping_ = true;
+  writer_.join();
+
+  try {
+    /* the stragglers, and what didn't fit */
+    string buffer;
+    drain( buffer );
+    for ( const auto & ring : rings_ ) {
+      const uint64_t dropped = ring->dropped.load();
+      if ( dropped ) {
+	const TraceRecord record { 0, DROPPED.id(), ring->thread, { dropped, 0, 0, 0 } };
+	buffer.append( reinterpret_cast<const char *>( &record ), sizeof( record ) );
+      }
+    }
+    file_.write( buffer );
+  } catch ( const exception & e ) { /* don't throw from destructor */
+    print_exception( e );
+  }
+}
+
+TraceLog::Ring * TraceLog::register_thread( void )
+{
+  unique_lock<mutex> lock( rings_mutex_ );
+  rings_.emplace_back( new Ring( ring_capacity_log2_, rings_.size() ) );
+  return rings_.back().get();
+}
+
+uint64_t TraceLog::dropped( void ) const
+{
+  unique_lock<mutex> lock( rings_mutex_ );
+  uint64_t total = 0;
+  for ( const auto & ring : rings_ ) {
+    total += ring->dropped.load( memory_order_relaxed );
+  }
+  return total;
+}
+
+/* copy every ring's new records into buffer (false if there were none) */
+bool TraceLog::drain( string & buffer )
+{
+  bool drained = false;
+  unique_lock<mutex> lock( rings_mutex_ );
+
+  for ( const auto & ring : rings_ ) {
+    const uint64_t head = ring->head.load( memory_order_relaxed );
+    const uint64_t tail = ring->tail.load( memory_order_acquire );
+
+    /* (in at most two pieces, since the ring wraps) */
+    for ( uint64_t i = head; i < tail; ) {
+      const uint64_t start = i & ring->mask;
+      const uint64_t count = min( tail - i, ring->slots.size() - start );
+      buffer.append( reinterpret_cast<const char *>( &ring->slots[ start ] ), count * sizeof( TraceRecord ) );
+      i += count;
+    }
+
+    ring->head.store( tail, memory_order_release );
+    drained |= tail != head;
+  }
+
+  return drained;
+}
+
+void TraceLog::write_loop( void )
+{
+  string buffer;
+
+  try {
+    while ( not stopping_ ) {
+      buffer.clear();
+      if ( drain( buffer ) ) {
+	file_.write( buffer );
+      } else {
+	/* nothing new: check again in a millisecond */
+	this_thread::sleep_for( chrono::milliseconds( 1 ) );
+      }
+    }
+  } catch ( const exception & e ) {
+    print_exception( e );
+  }
+}
@@ -0,0 +1,175 @@
+#ifndef TRACE_HH
+#define TRACE_HH
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "file_descriptor.hh"
+
+/* Low-overhead binary tracing. Code on the hot path appends fixed-size
+   records (an event, a timestamp and up to four values) to a lock-free
+   ring owned by its own thread; a background thread drains every ring
+   to a file, which trace_decode turns into text or CSV. With no
+   TraceLog open, trace() is one load and a branch; with one open, it is
+   a few stores. A full ring drops records (and counts them) rather than
+   ever making the traced thread wait. */
+
+/* what goes in the file, one per trace() call */
+struct TraceRecord
+{
+  uint64_t timestamp; /* ns, as the caller gave it (usually timestamp_ns()) */
+  uint32_t event;     /* TraceEvent::id() */
+  uint32_t thread;    /* in order of each thread's first record */
+  uint64_t values[ 4 ];
+};
+
+/* A kind of record, with a name and the names and types of its values,
+   e.g. TraceEvent( "ack", "seq:u rtt_ns:u window:f" ) (types are
+   u: unsigned, i: signed, f: double -- see trace_value()). Define them
+   at namespace scope: a log describes the events that existed when it
+   was opened. */
+class TraceEvent
+{
+private:
+  uint32_t id_;
+  const char * name_;
+  const char * fields_;
+
+public:
+  TraceEvent( const char * const name, const char * const fields );
+
+  uint32_t id( void ) const { return id_; }
+  const char * name( void ) const { return name_; }
+  const char * fields( void ) const { return fields_; }
+
+  /* every event defined so far (including the log's own "dropped",
+     which counts the records a thread's full ring lost) */
+  static const std::vector<const TraceEvent *> & all( void );
+
+  /* forbid copying, since the registry points at each one */
+  TraceEvent( const TraceEvent & other ) = delete;
+  const TraceEvent & operator=( const TraceEvent & other ) = delete;
+};
+
+/* store a record's value as its 64 bits (integers as themselves,
+   floating point as the bits of a double) */
+template <typename T>
+inline uint64_t trace_value( const T value ) { return static_cast<uint64_t>( value ); }
+
+inline uint64_t trace_value( const double value )
+{
+  uint64_t bits;
+  memcpy( &bits, &value, sizeof( bits ) );
+  return bits;
+}
+
+inline uint64_t trace_value( const float value ) { return trace_value( double( value ) ); }
+
+class TraceLog
+{
+private:
+  /* single-producer, single-consumer ring of records */
+  struct Ring
+  {
+    std::vector<TraceRecord> slots;
+    uint64_t mask;
+    uint32_t thread;
+
+    /* (the two ends on separate cache lines, so the threads don't share one) */
+    std::atomic<uint64_t> tail;    /* written by the traced thread */
+    std::atomic<uint64_t> dropped; /* (ditto) */
+    char padding[ 64 ];
+    std::atomic<uint64_t> head;    /* written by the writer thread */
+
+    Ring( const unsigned int capacity_log2, const uint32_t s_thread );
+  };
+
+  /* each thread's ring in the open log */
+  struct ThreadRing
+  {
+    uint64_t generation;
+    Ring * ring;
+  };
+
+  static std::atomic<TraceLog *> active_;
+  static std::atomic<uint64_t> generation_counter_;
+  static thread_local ThreadRing this_thread_ring_;
+
+  FileDescriptor file_;
+  unsigned int ring_capacity_log2_;
+  uint64_t generation_; /* tells apart logs that reuse an address */
+
+  mutable std::mutex rings_mutex_; /* (traced threads take it only to register) */
+  std::vector<std::unique_ptr<Ring>> rings_;
+
+  std::atomic<bool> stopping_;
+  std::thread writer_;
+
+  Ring * register_thread( void );
+
+  Ring & ring_for_this_thread( void )
+  {
+    ThreadRing & cached = this_thread_ring_;
+    if ( cached.generation != generation_ ) {
+      cached.ring = register_thread();
+      cached.generation = generation_;
+    }
+    return *cached.ring;
+  }
+
+  bool drain( std::string & buffer );
+  void write_loop( void );
+
+public:
+  /* start tracing to `filename` (replacing it), with room for
+     2^ring_capacity_log2 unwritten records per thread */
+  TraceLog( const std::string & filename, const unsigned int ring_capacity_log2 = 16 );
+
+  /* stop tracing, and write out everything still in the rings (once
+     the traced threads are done with it) */
+  ~TraceLog();
+
+  /* the open log, if any */
+  static TraceLog * active( void ) { return active_.load( std::memory_order_acquire ); }
+
+  void append( const TraceEvent & event, const uint64_t timestamp,
+	       const uint64_t a, const uint64_t b, const uint64_t c, const uint64_t d )
+  {
+    Ring & ring = ring_for_this_thread();
+    const uint64_t tail = ring.tail.load( std::memory_order_relaxed );
+    if ( tail - ring.head.load( std::memory_order_acquire ) > ring.mask ) {
+      ring.dropped.store( ring.dropped.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+      return;
+    }
+
+    ring.slots[ tail & ring.mask ] = TraceRecord { timestamp, event.id(), ring.thread, { a, b, c, d } };
+    ring.tail.store( tail + 1, std::memory_order_release );
+  }
+
+  /* records lost to full rings so far */
+  uint64_t dropped( void ) const;
+
+  /* forbid copying */
+  TraceLog( const TraceLog & other ) = delete;
+  const TraceLog & operator=( const TraceLog & other ) = delete;
+};
+
+/* record an event at `timestamp` (nanoseconds), if a TraceLog is open */
+template <typename A = uint64_t, typename B = uint64_t, typename C = uint64_t, typename D = uint64_t>
+inline void trace( const TraceEvent & event, const uint64_t timestamp,
+		   const A a = 0, const B b = 0, const C c = 0, const D d = 0 )
+{
+  TraceLog * const log = TraceLog::active();
+  if ( log ) {
+    log->append( event, timestamp, trace_value( a ), trace_value( b ),
+		 trace_value( c ), trace_value( d ) );
+  }
+}
+
+#endif /* TRACE_HH */
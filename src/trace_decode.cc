@@ -0,0 +1,176 @@
+/* print a TraceLog file as text, or one of its events as CSV */
+
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+
+#include "file_descriptor.hh"
+#include "trace.hh"
+#include "util.hh"
+
+using namespace std;
+
+struct Field
+{
+  string name;
+  char type; /* u, i or f */
+};
+
+struct EventDescription
+{
+  string name;
+  vector<Field> fields;
+
+  EventDescription() : name(), fields() {}
+};
+
+static string format_value( const Field & field, const uint64_t value )
+{
+  ostringstream out;
+  switch ( field.type ) {
+  case 'i':
+    out << int64_t( value );
+    break;
+  case 'f':
+    {
+      double d;
+      memcpy( &d, &value, sizeof( d ) );
+      out << d;
+    }
+    break;
+  default:
+    out << value;
+  }
+  return out.str();
+}
+
+int main( int argc, char *argv[] )
+{
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  if ( argc != 2 and argc != 3 ) {
+    cerr << "Usage: " << argv[ 0 ] << " TRACE_FILE [EVENT]  (with EVENT: that event, as CSV)" << endl;
+    return EXIT_FAILURE;
+  }
+
+  const string filename = argv[ 1 ];
+  const bool csv = argc == 3;
+  const string csv_event = csv ? argv[ 2 ] : "";
+
+  FileDescriptor file( SystemCall( "open " + filename, open( filename.c_str(), O_RDONLY | O_CLOEXEC ) ) );
+
+  /* the header: lines up to "records" */
+  string buffer;
+  map<uint32_t, EventDescription> events;
+  size_t records_start = string::npos;
+  while ( records_start == string::npos ) {
+    if ( file.eof() ) {
+      throw runtime_error( filename + ": not a complete trace header" );
+    }
+    buffer += file.read();
+
+    size_t line_start = 0;
+    for ( size_t newline; (newline = buffer.find( '\n', line_start )) != string::npos; line_start = newline + 1 ) {
+      istringstream line( buffer.substr( line_start, newline - line_start ) );
+      string keyword;
+      line >> keyword;
+
+      if ( line_start == 0 and keyword != "sourdough-trace" ) {
+	throw runtime_error( filename + ": not a trace file" );
+      } else if ( keyword == "event" ) {
+	uint32_t id;
+	line >> id;
+	EventDescription & event = events[ id ];
+	line >> event.name;
+	for ( string field; line >> field; ) {
+	  const size_t colon = field.rfind( ':' );
+	  event.fields.push_back( Field { field.substr( 0, colon ),
+		colon == string::npos ? 'u' : field.at( colon + 1 ) } );
+	}
+      } else if ( keyword == "records" ) {
+	records_start = newline + 1;
+	break;
+      }
+    }
+  }
+  buffer.erase( 0, records_start );
+
+  const EventDescription * selected = nullptr;
+  uint32_t selected_id = 0;
+  if ( csv ) {
+    for ( const auto & event : events ) {
+      if ( event.second.name == csv_event ) {
+	selected = &event.second;
+	selected_id = event.first;
+      }
+    }
+    if ( not selected ) {
+      throw runtime_error( filename + ": no event called " + csv_event );
+    }
+
+    cout << "timestamp_ns,thread";
+    for ( const Field & field : selected->fields ) {
+      cout << "," << field.name;
+    }
+    cout << endl;
+  }
+
+  /* the records, a buffer at a time */
+  cout << fixed;
+  while ( true ) {
+    size_t offset = 0;
+    for ( ; offset + sizeof( TraceRecord ) <= buffer.size(); offset += sizeof( TraceRecord ) ) {
+      TraceRecord record;
+      memcpy( &record, buffer.data() + offset, sizeof( record ) );
+
+      if ( csv ) {
+	if ( record.event == selected_id ) {
+	  cout << record.timestamp << "," << record.thread;
+	  for ( size_t i = 0; i < selected->fields.size() and i < 4; i++ ) {
+	    cout << "," << format_value( selected->fields[ i ], record.values[ i ] );
+	  }
+	  cout << "\n";
+	}
+	continue;
+      }
+
+      const auto event = events.find( record.event );
+      cout << setprecision( 6 ) << record.timestamp / 1.0e6 << " ms [" << record.thread << "] ";
+      if ( event == events.end() ) {
+	cout << "event" << record.event;
+	for ( const uint64_t value : record.values ) {
+	  cout << " " << value;
+	}
+      } else {
+	cout << event->second.name;
+	for ( size_t i = 0; i < event->second.fields.size() and i < 4; i++ ) {
+	  const Field & field = event->second.fields[ i ];
+	  cout << " " << field.name << "=" << format_value( field, record.values[ i ] );
+	}
+      }
+      cout << "\n";
+    }
+    buffer.erase( 0, offset );
+
+    if ( file.eof() ) {
+      break;
+    }
+    buffer += file.read();
+  }
+
+  if ( not buffer.empty() ) {
+    cerr << filename << ": ignoring " << buffer.size() << " bytes of a partial record at the end" << endl;
+  }
+
+  return EXIT_SUCCESS;
+}